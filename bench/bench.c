@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "base.h"
+#include "stats.h"
+#include "front/front.h"
+#include "back/cb.h"
+
+#include "gen.h"
+#include "micro.h"
+
+// Compile-time benchmark over generated programs. Each sweep grows one dimension of the base program,
+// so a phase whose ns/node climbs along a sweep is scaling super-linearly in that dimension.
+
+typedef struct {
+  char* name;
+  gen_params_t params;
+} size_class_t;
+
+#define BASE(funcs, locals, depth, loops, stmts) { funcs, locals, depth, loops, stmts, 0x5eed }
+
+static size_class_t size_classes[] = {
+  { "base",       BASE(1,   8,  2, 1,    8) },
+
+  { "locals_32",  BASE(1,  32,  2, 1,    8) },
+  { "locals_128", BASE(1, 128,  2, 1,    8) },
+  { "locals_512", BASE(1, 512,  2, 1,    8) },
+
+  { "depth_8",    BASE(1,   8,  8, 1,    8) },
+  { "depth_32",   BASE(1,   8, 32, 1,    8) },
+  { "depth_128",  BASE(1,   8, 128, 1,   8) },
+
+  { "loops_8",    BASE(1,   8,  2, 8,    8) },
+  { "loops_32",   BASE(1,   8,  2, 32,   8) },
+  { "loops_128",  BASE(1,   8,  2, 128,  8) },
+
+  { "stmts_64",   BASE(1,   8,  2, 1,   64) },
+  { "stmts_512",  BASE(1,   8,  2, 1,  512) },
+  { "stmts_2048", BASE(1,   8,  2, 1, 2048) },
+
+  { "funcs_16",   BASE(16,  8,  2, 1,    8) },
+  { "funcs_128",  BASE(128, 8,  2, 1,    8) },
+};
+
+#undef BASE
+
+#define X(name, label, ...) label,
+static char* phase_label[] = {
+  #include "stat_phase.def"
+};
+#undef X
+
+typedef struct {
+  uint64_t total_ns;
+  uint64_t phase_ns[NUM_STAT_PHASES];
+  uint64_t nodes;
+  size_t peak_bytes;
+} bench_result_t;
+
+static void compile(bench_result_t* result, char* source, cb_regalloc_t regalloc) {
+  arena_t* arena = new_arena();
+  cb_opt_context_t* opt = cb_new_opt_context();
+
+  stats_reset();
+  scratch_take_peak();
+
+  uint64_t start = time_now_ns();
+
+  lexer_t lexer = lexer_init("bench", source);
+
+  stats_begin_phase(STAT_PHASE_PARSE);
+  sem_unit_t* unit = parse_unit(arena, &lexer);
+  stats_end_phase(STAT_PHASE_PARSE);
+
+  if (!unit) {
+    printf("Generated program failed to parse\n");
+    exit(1);
+  }
+
+  foreach_list(sem_func_t, func, unit->funcs) {
+    stats_set_func(func->name);
+
+    stats_begin_phase(STAT_PHASE_SEM_ANALYZE);
+    bool success = sem_analyze("bench", source, func);
+    stats_end_phase(STAT_PHASE_SEM_ANALYZE);
+
+    if (!success) {
+      printf("Generated program failed analysis\n");
+      exit(1);
+    }
+
+    stats_begin_phase(STAT_PHASE_SEM_LOWER);
+    cb_func_t* cb_func = sem_lower(arena, func);
+    stats_end_phase(STAT_PHASE_SEM_LOWER);
+
+    stats_begin_phase(STAT_PHASE_OPT);
+    cb_opt_func(opt, cb_func);
+    stats_end_phase(STAT_PHASE_OPT);
+
+    stats_begin_phase(STAT_PHASE_SELECT_X64);
+    cb_func_t* x64_func = cb_select_x64(arena, cb_func);
+    stats_end_phase(STAT_PHASE_SELECT_X64);
+
+    stats_begin_phase(STAT_PHASE_GENERATE_X64);
+    cb_generate_x64(arena, NULL, x64_func, regalloc);
+    stats_end_phase(STAT_PHASE_GENERATE_X64);
+  }
+
+  result->total_ns = time_now_ns() - start;
+
+  for (int i = 0; i < NUM_STAT_PHASES; ++i) {
+    result->phase_ns[i] = stats_phase_ns(i);
+  }
+
+  result->nodes = stats_counter(STAT_NODES_CREATED);
+  result->peak_bytes = arena_get_stats(arena).high_water + scratch_take_peak();
+
+  cb_free_opt_context(opt);
+  free_arena(arena);
+}
+
+static void print_header() {
+  printf("%-12s%10s%10s%12s%10s", "class", "src_kb", "nodes", "total_ms", "ns/node");
+
+  for (int i = 0; i < NUM_STAT_PHASES; ++i) {
+    printf("%14s", phase_label[i]);
+  }
+
+  printf("%12s\n", "peak_kb");
+}
+
+static void run_class(size_class_t* c, int reps, cb_regalloc_t regalloc) {
+  arena_t* source_arena = new_arena(); // not scratch so it doesn't count towards the peak
+
+  char* source = gen_program(source_arena, &c->params);
+
+  bench_result_t best = {0};
+
+  for (int i = -1; i < reps; ++i) { // first run is warmup
+    bench_result_t result = {0};
+    compile(&result, source, regalloc);
+
+    if (i >= 0 && (!best.total_ns || result.total_ns < best.total_ns)) {
+      best = result;
+    }
+  }
+
+  printf("%-12s%10.1f%10llu%12.3f%10.1f", c->name, (double)strlen(source) / 1024.0, (unsigned long long)best.nodes,
+    (double)best.total_ns / 1e6, best.nodes ? (double)best.total_ns / (double)best.nodes : 0.0);
+
+  for (int i = 0; i < NUM_STAT_PHASES; ++i) {
+    printf("%14.3f", (double)best.phase_ns[i] / 1e6);
+  }
+
+  printf("%12.1f\n", (double)best.peak_bytes / 1024.0);
+
+  free_arena(source_arena);
+}
+
+static size_class_t* find_class(char* name) {
+  for (int i = 0; i < ARRAY_LENGTH(size_classes); ++i) {
+    if (strcmp(size_classes[i].name, name) == 0) {
+      return size_classes + i;
+    }
+  }
+
+  printf("Unknown size class '%s'\n", name);
+  exit(1);
+}
+
+static void print_usage(char* exe) {
+  printf("Usage: %s [options]\n", exe);
+  printf("  -reps=<n>      timed runs per size class, the fastest is reported (default 3)\n");
+  printf("  -class=<name>  only run one size class\n");
+  printf("  -emit=<name>   print the program generated for a size class and exit\n");
+  printf("  -regalloc=<kind> graph or linear register allocation (default graph)\n");
+  printf("  -micro[=<name>] run the component microbenchmarks instead, or just one of them\n");
+  printf("  -warmup=<n>    untimed runs before each microbenchmark (default 2)\n");
+  printf("  -json=<file>   write microbenchmark results as json\n");
+  printf("classes:");
+
+  for (int i = 0; i < ARRAY_LENGTH(size_classes); ++i) {
+    printf(" %s", size_classes[i].name);
+  }
+
+  printf("\n");
+}
+
+int main(int argc, char** argv) {
+  int reps = 3;
+  size_class_t* only = NULL;
+  size_class_t* emit = NULL;
+  cb_regalloc_t regalloc = CB_REGALLOC_GRAPH_COLORING;
+
+  bool micro = false;
+
+  micro_options_t micro_options = {
+    .warmup = 2
+  };
+
+  for (int i = 1; i < argc; ++i) {
+    char* arg = argv[i];
+
+    if (strncmp(arg, "-reps=", 6) == 0 && atoi(arg + 6) > 0) {
+      reps = atoi(arg + 6);
+    }
+    else if (strncmp(arg, "-class=", 7) == 0) {
+      only = find_class(arg + 7);
+    }
+    else if (strncmp(arg, "-emit=", 6) == 0) {
+      emit = find_class(arg + 6);
+    }
+    else if (strcmp(arg, "-regalloc=graph") == 0) {
+      regalloc = CB_REGALLOC_GRAPH_COLORING;
+    }
+    else if (strcmp(arg, "-regalloc=linear") == 0) {
+      regalloc = CB_REGALLOC_LINEAR_SCAN;
+    }
+    else if (strcmp(arg, "-micro") == 0) {
+      micro = true;
+    }
+    else if (strncmp(arg, "-micro=", 7) == 0) {
+      micro = true;
+      micro_options.only = arg + 7;
+    }
+    else if (strncmp(arg, "-warmup=", 8) == 0) {
+      micro_options.warmup = atoi(arg + 8);
+    }
+    else if (strncmp(arg, "-json=", 6) == 0) {
+      micro_options.json_path = arg + 6;
+    }
+    else {
+      printf("Unknown option '%s'\n", arg);
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  init_globals();
+
+  if (emit) {
+    scratch_t scratch = scratch_get(0, NULL);
+    printf("%s", gen_program(scratch.arena, &emit->params));
+    scratch_release(&scratch);
+    return 0;
+  }
+
+  if (micro) {
+    micro_options.reps = reps;
+    return run_microbenchmarks(&micro_options) ? 0 : 1;
+  }
+
+  stats_enable();
+  print_header();
+
+  for (int i = 0; i < ARRAY_LENGTH(size_classes); ++i) {
+    if (!only || only == size_classes + i) {
+      run_class(size_classes + i, reps, regalloc);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "gen.h"
+
+typedef struct {
+  gen_params_t* params;
+  uint64_t rng;
+
+  vec_t(char) out;
+  int indent;
+
+  int loops_left;
+  int next_counter;
+} gen_t;
+
+static uint64_t next_random(gen_t* g) {
+  // splitmix64
+  uint64_t z = (g->rng += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+static int random_range(gen_t* g, int lo, int hi) {
+  return lo + (int)(next_random(g) % (uint64_t)(hi - lo + 1));
+}
+
+static void emit(gen_t* g, char* fmt, ...) {
+  char buf[256];
+
+  va_list ap;
+  va_start(ap, fmt);
+  int count = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+
+  assert(count >= 0 && (size_t)count < sizeof(buf));
+
+  for (int i = 0; i < count; ++i) {
+    vec_put(g->out, buf[i]);
+  }
+}
+
+static void emit_indent(gen_t* g) {
+  for (int i = 0; i < g->indent; ++i) {
+    emit(g, "  ");
+  }
+}
+
+static int random_local(gen_t* g) {
+  return random_range(g, 0, g->params->locals-1);
+}
+
+static void gen_straight_line(gen_t* g) {
+  static char ops[] = "+-*";
+
+  for (int i = 0; i < g->params->stmts; ++i) {
+    emit_indent(g);
+
+    // only ever divide by constants so running the program can't trap
+    if (random_range(g, 0, 3) == 0) {
+      emit(g, "v%d = v%d / %d + v%d;\n", random_local(g), random_local(g), random_range(g, 1, 9), random_local(g));
+    }
+    else {
+      emit(g, "v%d = v%d %c v%d %c %d;\n", random_local(g), random_local(g), ops[random_range(g, 0, 2)], random_local(g), ops[random_range(g, 0, 1)], random_range(g, 1, 9));
+    }
+  }
+}
+
+static void gen_nest(gen_t* g, int depth) {
+  gen_straight_line(g);
+
+  bool nest = depth < g->params->depth || (depth == 0 && g->loops_left > 0);
+
+  if (!nest) {
+    return;
+  }
+
+  if (g->loops_left > 0) {
+    g->loops_left--;
+    int counter = g->next_counter++;
+
+    emit_indent(g); emit(g, "c%d = %d;\n", counter, random_range(g, 2, 9));
+    emit_indent(g); emit(g, "while (c%d) {\n", counter);
+
+    g->indent++;
+    gen_nest(g, depth+1);
+    emit_indent(g); emit(g, "c%d = c%d - 1;\n", counter, counter);
+    g->indent--;
+
+    emit_indent(g); emit(g, "}\n");
+  }
+  else {
+    emit_indent(g); emit(g, "if (v%d - v%d) {\n", random_local(g), random_local(g));
+
+    g->indent++;
+    gen_nest(g, depth+1);
+    g->indent--;
+
+    emit_indent(g); emit(g, "} else {\n");
+
+    g->indent++;
+    gen_straight_line(g);
+    g->indent--;
+
+    emit_indent(g); emit(g, "}\n");
+  }
+
+  gen_straight_line(g);
+}
+
+static void gen_func(gen_t* g, char* name) {
+  gen_params_t* params = g->params;
+
+  emit(g, "int %s() {\n", name);
+  g->indent = 1;
+
+  for (int i = 0; i < params->locals; ++i) {
+    emit_indent(g); emit(g, "int v%d;\n", i);
+  }
+
+  for (int i = 0; i < params->loops; ++i) {
+    emit_indent(g); emit(g, "int c%d;\n", i);
+  }
+
+  for (int i = 0; i < params->locals; ++i) {
+    emit_indent(g); emit(g, "v%d = %d;\n", i, random_range(g, 1, 100));
+  }
+
+  g->loops_left = params->loops;
+  g->next_counter = 0;
+
+  do {
+    gen_nest(g, 0);
+  } while (g->loops_left > 0);
+
+  emit_indent(g); emit(g, "return v%d + v%d;\n", random_local(g), random_local(g));
+  emit(g, "}\n\n");
+}
+
+char* gen_program(arena_t* arena, gen_params_t* params) {
+  assert(params->funcs >= 1 && params->locals >= 1);
+
+  gen_t g = {
+    .params = params,
+    .rng = params->seed
+  };
+
+  for (int i = 0; i < params->funcs-1; ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "f%d", i);
+    gen_func(&g, name);
+  }
+
+  gen_func(&g, "main");
+
+  vec_put(g.out, '\0');
+
+  return vec_bake(arena, g.out);
+}
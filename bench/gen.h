@@ -0,0 +1,17 @@
+#pragma once
+
+#include "base.h"
+
+// Generates programs in the subset the front end supports: int locals, + - * /, if/else, while and return.
+// Every loop counts a dedicated local down to zero so the programs terminate if they're ever run.
+
+typedef struct {
+  int funcs; // the last one is main
+  int locals; // per function, not counting loop counters
+  int depth; // nesting depth of if/while
+  int loops; // while loops per function, nested as deep as depth allows
+  int stmts; // straight-line assignments per block
+  uint64_t seed;
+} gen_params_t;
+
+char* gen_program(arena_t* arena, gen_params_t* params);
@@ -0,0 +1,624 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "micro.h"
+#include "gen.h"
+#include "front/front.h"
+#include "back/internal.h"
+
+// Microbenchmarks for individual backend components. Setup runs untimed before every repetition
+// so benchmarks that mutate their input (coloring, dominators) always start from the same state.
+
+typedef struct {
+  arena_t* arena;
+  uint64_t rng;
+
+  char* source;
+  size_t source_length;
+
+  cb_func_t* func; // optimized, for walks and gvn
+  cb_func_t* x64_func; // selected, for building machine functions
+
+  int node_count;
+  cb_node_t** nodes;
+  gvn_table_t gvn;
+  vec_t(gvn_op_t) gvn_ops;
+
+  cb_block_t* cfg_head;
+  int block_count;
+
+  machine_func_t* machine_func;
+} micro_state_t;
+
+typedef void(*micro_setup_t)(micro_state_t* state);
+typedef double(*micro_run_t)(micro_state_t* state); // returns the number of items processed
+
+typedef struct {
+  char* name;
+  char* unit;
+  double unit_scale; // items per unit
+  micro_setup_t setup;
+  micro_run_t run;
+} micro_bench_t;
+
+static gen_params_t lexer_program = { .funcs = 64, .locals = 32, .depth = 4, .loops = 4, .stmts = 64, .seed = 1 };
+static gen_params_t backend_program = { .funcs = 1, .locals = 32, .depth = 6, .loops = 4, .stmts = 48, .seed = 2 };
+static gen_params_t large_backend_program = { .funcs = 1, .locals = 8, .depth = 2, .loops = 1, .stmts = 2048, .seed = 2 };
+
+#define GVN_NODE_COUNT 65536
+#define CFG_BLOCK_COUNT 16384
+#define CFG_MAX_DEPTH 64
+
+static uint64_t next_random(micro_state_t* state) {
+  // splitmix64
+  uint64_t z = (state->rng += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+// front end to selected x64 graph, the result is cached per program since every rep can share it
+static void compile_backend_program(gen_params_t* params, cb_func_t** out_func, cb_func_t** out_x64_func) {
+  static arena_t* arena;
+  static gen_params_t* compiled[2];
+  static cb_func_t* funcs[2];
+  static cb_func_t* x64_funcs[2];
+
+  int i = 0;
+
+  while (compiled[i] && compiled[i] != params) {
+    i++;
+    assert(i < ARRAY_LENGTH(compiled));
+  }
+
+  if (!compiled[i]) {
+    if (!arena) {
+      arena = new_arena();
+    }
+
+    char* source = gen_program(arena, params);
+    lexer_t lexer = lexer_init("micro", source);
+    sem_unit_t* unit = parse_unit(arena, &lexer);
+
+    bool success = unit && sem_analyze("micro", source, unit->funcs);
+    assert(success);
+    (void)success;
+
+    funcs[i] = sem_lower(arena, unit->funcs);
+
+    cb_opt_context_t* opt = cb_new_opt_context();
+    cb_opt_func(opt, funcs[i]);
+    cb_free_opt_context(opt);
+
+    x64_funcs[i] = cb_select_x64(arena, funcs[i]);
+    compiled[i] = params;
+  }
+
+  *out_func = funcs[i];
+  *out_x64_func = x64_funcs[i];
+}
+
+static void setup_lexer(micro_state_t* state) {
+  state->source = gen_program(state->arena, &lexer_program);
+  state->source_length = strlen(state->source);
+}
+
+static double run_lexer(micro_state_t* state) {
+  lexer_t lexer = lexer_init("micro", state->source);
+
+  while (lexer_next(&lexer).kind != TOKEN_EOF) {
+  }
+
+  return (double)state->source_length;
+}
+
+static void setup_gvn(micro_state_t* state) {
+  cb_func_t* func = cb_new_func(state->arena);
+
+  state->node_count = GVN_NODE_COUNT;
+  state->nodes = arena_array(state->arena, cb_node_t*, GVN_NODE_COUNT);
+
+  int constant_count = GVN_NODE_COUNT / 16;
+
+  for (int i = 0; i < constant_count; ++i) {
+    state->nodes[i] = cb_node_constant(func, i);
+  }
+
+  // random binary ops over the constants, duplicates are fine - they're what gvn is for
+  for (int i = constant_count; i < GVN_NODE_COUNT; ++i) {
+    cb_node_t* lhs = state->nodes[next_random(state) % i];
+    cb_node_t* rhs = state->nodes[next_random(state) % i];
+    state->nodes[i] = next_random(state) % 2 ? cb_node_add(func, lhs, rhs) : cb_node_mul(func, lhs, rhs);
+  }
+
+  state->gvn = (gvn_table_t){0};
+}
+
+// the table traffic of optimizing every function in a generated unit, recorded once and shared
+static vec_t(gvn_op_t) record_gvn_ops() {
+  static arena_t* arena;
+  static vec_t(gvn_op_t) ops;
+
+  if (!arena) {
+    arena = new_arena();
+
+    char* source = gen_program(arena, &lexer_program);
+    lexer_t lexer = lexer_init("micro", source);
+    sem_unit_t* unit = parse_unit(arena, &lexer);
+    assert(unit);
+
+    cb_opt_context_t* opt = cb_new_opt_context();
+    gvn_record(arena, &ops);
+
+    foreach_list(sem_func_t, func, unit->funcs) {
+      bool success = sem_analyze("micro", source, func);
+      assert(success);
+      (void)success;
+
+      cb_opt_func(opt, sem_lower(arena, func));
+    }
+
+    gvn_record(NULL, NULL);
+    cb_free_opt_context(opt);
+  }
+
+  return ops;
+}
+
+static void setup_gvn_replay(micro_state_t* state) {
+  state->gvn_ops = record_gvn_ops();
+  state->gvn = (gvn_table_t){0};
+}
+
+static double run_gvn_replay(micro_state_t* state) {
+  for (int i = 0; i < vec_len(state->gvn_ops); ++i) {
+    gvn_op_t* op = state->gvn_ops + i;
+
+    switch (op->kind) {
+      case GVN_OP_GET:
+        gvn_get(&state->gvn, op->node);
+        break;
+
+      case GVN_OP_REMOVE:
+        gvn_remove(&state->gvn, op->node);
+        break;
+
+      case GVN_OP_CLEAR:
+        gvn_clear(&state->gvn);
+        break;
+    }
+  }
+
+  gvn_free_table(&state->gvn);
+  return (double)vec_len(state->gvn_ops);
+}
+
+static void setup_gvn_filled(micro_state_t* state) {
+  setup_gvn(state);
+
+  for (int i = 0; i < state->node_count; ++i) {
+    gvn_get(&state->gvn, state->nodes[i]);
+  }
+}
+
+static double run_gvn_insert(micro_state_t* state) {
+  for (int i = 0; i < state->node_count; ++i) {
+    gvn_get(&state->gvn, state->nodes[i]);
+  }
+
+  gvn_free_table(&state->gvn);
+  return state->node_count;
+}
+
+static double run_gvn_lookup(micro_state_t* state) {
+  for (int i = 0; i < state->node_count; ++i) {
+    gvn_get(&state->gvn, state->nodes[i]);
+  }
+
+  gvn_free_table(&state->gvn);
+  return state->node_count;
+}
+
+static double run_gvn_remove(micro_state_t* state) {
+  for (int i = 0; i < state->node_count; ++i) {
+    gvn_remove(&state->gvn, state->nodes[i]);
+  }
+
+  gvn_free_table(&state->gvn);
+  return state->node_count;
+}
+
+static cb_block_t* new_cfg_block(micro_state_t* state, cb_block_t** tail) {
+  cb_block_t* b = arena_type(state->arena, cb_block_t);
+  b->id = state->block_count++;
+  b->predecessors = arena_array(state->arena, cb_block_t*, 2); // structured regions never join more than two edges
+
+  *tail = (*tail)->next = b;
+  return b;
+}
+
+static void cfg_edge(cb_block_t* from, cb_block_t* to) {
+  assert(from->successor_count < 2 && to->predecessor_count < 2);
+  from->successors[from->successor_count++] = to;
+  to->predecessors[to->predecessor_count++] = from;
+}
+
+// blocks are numbered as they're created, which is a reverse post-order for structured control flow
+static cb_block_t* gen_cfg_region(micro_state_t* state, cb_block_t** tail, cb_block_t* current, int depth) {
+  while (state->block_count < CFG_BLOCK_COUNT) {
+    int kind = depth < CFG_MAX_DEPTH ? (int)(next_random(state) % 4) : 0;
+
+    switch (kind) {
+      case 0: {
+        cb_block_t* next = new_cfg_block(state, tail);
+        cfg_edge(current, next);
+        current = next;
+      } break;
+
+      case 1: {
+        cb_block_t* then_block = new_cfg_block(state, tail);
+        cfg_edge(current, then_block);
+        cb_block_t* then_end = gen_cfg_region(state, tail, then_block, depth+1);
+
+        cb_block_t* else_block = new_cfg_block(state, tail);
+        cfg_edge(current, else_block);
+        cb_block_t* else_end = gen_cfg_region(state, tail, else_block, depth+1);
+
+        cb_block_t* join = new_cfg_block(state, tail);
+        cfg_edge(then_end, join);
+        cfg_edge(else_end, join);
+        current = join;
+      } break;
+
+      case 2: {
+        cb_block_t* header = new_cfg_block(state, tail);
+        cfg_edge(current, header);
+
+        cb_block_t* body = new_cfg_block(state, tail);
+        cfg_edge(header, body);
+        cb_block_t* body_end = gen_cfg_region(state, tail, body, depth+1);
+        cfg_edge(body_end, header);
+
+        cb_block_t* exit = new_cfg_block(state, tail);
+        cfg_edge(header, exit);
+        current = exit;
+      } break;
+
+      case 3: {
+        if (depth > 0) {
+          return current;
+        }
+      } break;
+    }
+  }
+
+  return current;
+}
+
+static void setup_dominators(micro_state_t* state) {
+  cb_block_t head = {0};
+  cb_block_t* tail = &head;
+
+  state->block_count = 0;
+  cb_block_t* entry = new_cfg_block(state, &tail);
+  gen_cfg_region(state, &tail, entry, 0);
+
+  state->cfg_head = head.next;
+}
+
+// a long chain where every block can also leave early to one shared exit, like a big && chain
+// or a run of early returns. the exit joins every block so the fixpoint's intersect walks are long.
+static void setup_exit_chain(micro_state_t* state) {
+  cb_block_t head = {0};
+  cb_block_t* tail = &head;
+
+  state->block_count = 0;
+  cb_block_t* current = new_cfg_block(state, &tail);
+
+  cb_block_t* exit = arena_type(state->arena, cb_block_t);
+  exit->predecessors = arena_array(state->arena, cb_block_t*, CFG_BLOCK_COUNT);
+
+  while (state->block_count < CFG_BLOCK_COUNT) {
+    cb_block_t* next = new_cfg_block(state, &tail);
+    cfg_edge(current, next);
+
+    current->successors[current->successor_count++] = exit;
+    exit->predecessors[exit->predecessor_count++] = current;
+
+    current = next;
+  }
+
+  current->successors[current->successor_count++] = exit;
+  exit->predecessors[exit->predecessor_count++] = current;
+
+  exit->id = state->block_count++;
+  tail->next = exit;
+
+  state->cfg_head = head.next;
+}
+
+static double run_dominators(micro_state_t* state) {
+  build_dominator_tree(state->arena, state->cfg_head);
+  return state->block_count;
+}
+
+static double run_loop_forest(micro_state_t* state) {
+  int loop_count;
+  build_loop_forest(state->arena, state->cfg_head, &loop_count);
+  return state->block_count;
+}
+
+static double run_idoms_semi_nca(micro_state_t* state) {
+  compute_idoms(state->cfg_head);
+  return state->block_count;
+}
+
+static cb_block_t* chk_intersect(cb_block_t* f1, cb_block_t* f2) {
+  while (f1 != f2) {
+    while (f1->id > f2->id) {
+      f1 = f1->idom;
+    }
+
+    while (f2->id > f1->id) {
+      f2 = f2->idom;
+    }
+  }
+
+  return f1;
+}
+
+// the cooper-harvey-kennedy fixpoint that build_dominator_tree used before semi-nca, kept as a baseline
+static void chk_idoms(cb_block_t* cfg_head) {
+  foreach_list (cb_block_t, b, cfg_head) {
+    b->idom = NULL;
+  }
+
+  cfg_head->idom = cfg_head;
+
+  for (bool changed = true; changed;) {
+    changed = false;
+
+    foreach_list (cb_block_t, b, cfg_head->next) {
+      cb_block_t* new_idom = NULL;
+
+      for (int i = 0; i < b->predecessor_count; ++i) {
+        cb_block_t* p = b->predecessors[i];
+
+        if (!p->idom) {
+          continue;
+        }
+
+        new_idom = new_idom ? chk_intersect(p, new_idom) : p;
+      }
+
+      if (b->idom != new_idom) {
+        b->idom = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  cfg_head->idom = NULL;
+}
+
+static void verify_idoms(micro_state_t* state) {
+  // both algorithms have to agree before the timings mean anything
+  cb_block_t** expected = arena_array(state->arena, cb_block_t*, state->block_count);
+  compute_idoms(state->cfg_head);
+
+  foreach_list (cb_block_t, b, state->cfg_head) {
+    expected[b->id] = b->idom;
+  }
+
+  chk_idoms(state->cfg_head);
+
+  foreach_list (cb_block_t, b, state->cfg_head) {
+    if (b->idom != expected[b->id]) {
+      printf("fixpoint and semi-nca disagree on block %d\n", b->id);
+      exit(1);
+    }
+  }
+}
+
+static void setup_idoms_chk(micro_state_t* state) {
+  setup_dominators(state);
+  verify_idoms(state);
+}
+
+static void setup_chk_exits(micro_state_t* state) {
+  setup_exit_chain(state);
+  verify_idoms(state);
+}
+
+static double run_idoms_chk(micro_state_t* state) {
+  chk_idoms(state->cfg_head);
+  return state->block_count;
+}
+
+static void setup_walk(micro_state_t* state) {
+  cb_func_t* x64_func;
+  compile_backend_program(&backend_program, &state->func, &x64_func);
+}
+
+static double run_walk(micro_state_t* state) {
+  func_walk_t walk = func_walk_post_order_ins(state->arena, state->func, NULL);
+  return (double)walk.len;
+}
+
+static void setup_machine_func(micro_state_t* state) {
+  compile_backend_program(&backend_program, &state->func, &state->x64_func);
+  state->machine_func = x64_build_machine_func(state->arena, state->x64_func);
+}
+
+// about 48k virtual registers, enough that anything quadratic in them shows up
+static void setup_large_machine_func(micro_state_t* state) {
+  compile_backend_program(&large_backend_program, &state->func, &state->x64_func);
+  state->machine_func = x64_build_machine_func(state->arena, state->x64_func);
+}
+
+static double run_live_out(micro_state_t* state) {
+  compute_live_out(state->arena, state->machine_func);
+  return x64_machine_inst_count(state->machine_func);
+}
+
+static double run_build_intf(micro_state_t* state) {
+  x64_build_intf(state->machine_func);
+  return x64_machine_inst_count(state->machine_func);
+}
+
+static double run_try_color(micro_state_t* state) {
+  int count = x64_machine_inst_count(state->machine_func);
+  regalloc_try_color(state->arena, state->machine_func);
+  return count;
+}
+
+static double run_linear_scan(micro_state_t* state) {
+  int count = x64_machine_inst_count(state->machine_func);
+  regalloc_linear_scan(state->arena, state->machine_func);
+  return count;
+}
+
+static micro_bench_t benchmarks[] = {
+  { "lexer_next",               "MB",    1024.0 * 1024.0, setup_lexer,        run_lexer },
+  { "gvn_insert",               "ops",   1.0,             setup_gvn,          run_gvn_insert },
+  { "gvn_lookup",               "ops",   1.0,             setup_gvn_filled,   run_gvn_lookup },
+  { "gvn_remove",               "ops",   1.0,             setup_gvn_filled,   run_gvn_remove },
+  { "gvn_replay",               "ops",   1.0,             setup_gvn_replay,   run_gvn_replay },
+  { "build_dominator_tree",     "blocks", 1.0,            setup_dominators,   run_dominators },
+  { "build_loop_forest",        "blocks", 1.0,            setup_dominators,   run_loop_forest },
+  { "idoms_semi_nca",           "blocks", 1.0,            setup_dominators,   run_idoms_semi_nca },
+  { "idoms_chk_fixpoint",       "blocks", 1.0,            setup_idoms_chk,    run_idoms_chk },
+  { "idoms_semi_nca_exits",     "blocks", 1.0,            setup_exit_chain,   run_idoms_semi_nca },
+  { "idoms_chk_fixpoint_exits", "blocks", 1.0,            setup_chk_exits,    run_idoms_chk },
+  { "func_walk_post_order_ins", "nodes", 1.0,             setup_walk,         run_walk },
+  { "compute_live_out",         "insts", 1.0,             setup_machine_func, run_live_out },
+  { "build_intf",               "insts", 1.0,             setup_machine_func, run_build_intf },
+  { "regalloc_try_color",       "insts", 1.0,             setup_machine_func, run_try_color },
+  { "build_intf_large",         "insts", 1.0,             setup_large_machine_func, run_build_intf },
+  { "regalloc_try_color_large", "insts", 1.0,             setup_large_machine_func, run_try_color },
+  { "regalloc_linear_scan",     "insts", 1.0,             setup_machine_func, run_linear_scan },
+};
+
+typedef struct {
+  micro_bench_t* bench;
+  double items;
+  double min_ns;
+  double median_ns;
+  double mean_ns;
+  double stddev_ns;
+  double throughput; // units per second at the median
+} micro_result_t;
+
+static int compare_doubles(const void* a, const void* b) {
+  double x = *(double*)a;
+  double y = *(double*)b;
+  return (x > y) - (x < y);
+}
+
+static micro_result_t run_benchmark(micro_bench_t* bench, micro_options_t* options) {
+  double* samples = calloc(options->reps, sizeof(double));
+  assert(samples);
+
+  double items = 0.0;
+
+  for (int i = -options->warmup; i < options->reps; ++i) {
+    micro_state_t state = {
+      .arena = new_arena(),
+      .rng = 0x5eed
+    };
+
+    bench->setup(&state);
+
+    uint64_t start = time_now_ns();
+    items = bench->run(&state);
+    uint64_t end = time_now_ns();
+
+    if (i >= 0) {
+      samples[i] = (double)(end - start);
+    }
+
+    free_arena(state.arena);
+  }
+
+  qsort(samples, options->reps, sizeof(double), compare_doubles);
+
+  micro_result_t result = {
+    .bench = bench,
+    .items = items,
+    .min_ns = samples[0],
+    .median_ns = options->reps % 2 ? samples[options->reps/2] : (samples[options->reps/2-1] + samples[options->reps/2]) * 0.5
+  };
+
+  for (int i = 0; i < options->reps; ++i) {
+    result.mean_ns += samples[i];
+  }
+
+  result.mean_ns /= options->reps;
+
+  for (int i = 0; i < options->reps; ++i) {
+    double d = samples[i] - result.mean_ns;
+    result.stddev_ns += d * d;
+  }
+
+  result.stddev_ns = options->reps > 1 ? sqrt(result.stddev_ns / (options->reps - 1)) : 0.0;
+  result.throughput = result.median_ns > 0.0 ? (items / bench->unit_scale) / (result.median_ns / 1e9) : 0.0;
+
+  free(samples);
+  return result;
+}
+
+static void write_json(FILE* file, micro_options_t* options, micro_result_t* results, int count) {
+  fprintf(file, "{\n  \"warmup\": %d,\n  \"reps\": %d,\n  \"benchmarks\": [\n", options->warmup, options->reps);
+
+  for (int i = 0; i < count; ++i) {
+    micro_result_t* r = results + i;
+
+    fprintf(file, "    {\"name\": \"%s\", \"unit\": \"%s\", \"items\": %.0f, \"min_ns\": %.0f, \"median_ns\": %.0f, \"mean_ns\": %.1f, \"stddev_ns\": %.1f, \"throughput_per_s\": %.3f}%s\n",
+      r->bench->name, r->bench->unit, r->items, r->min_ns, r->median_ns, r->mean_ns, r->stddev_ns, r->throughput, i+1 < count ? "," : "");
+  }
+
+  fprintf(file, "  ]\n}\n");
+}
+
+bool run_microbenchmarks(micro_options_t* options) {
+  micro_result_t results[ARRAY_LENGTH(benchmarks)];
+  int count = 0;
+
+  printf("%-26s%12s%12s%12s%12s%14s\n", "benchmark", "items", "min_us", "median_us", "stddev_us", "throughput");
+
+  for (int i = 0; i < ARRAY_LENGTH(benchmarks); ++i) {
+    micro_bench_t* bench = benchmarks + i;
+
+    if (options->only && strcmp(options->only, bench->name) != 0) {
+      continue;
+    }
+
+    micro_result_t r = results[count++] = run_benchmark(bench, options);
+
+    // plain counts read better in millions
+    bool millions = bench->unit_scale == 1.0;
+
+    printf("%-26s%12.0f%12.1f%12.1f%12.1f%14.2f %s%s/s\n", bench->name, r.items, r.min_ns / 1e3, r.median_ns / 1e3, r.stddev_ns / 1e3,
+      millions ? r.throughput / 1e6 : r.throughput, millions ? "M" : "", bench->unit);
+  }
+
+  if (!count) {
+    printf("No microbenchmark named '%s'\n", options->only);
+    return false;
+  }
+
+  if (options->json_path) {
+    FILE* file;
+    if (fopen_s(&file, options->json_path, "w")) {
+      printf("Failed to write '%s'\n", options->json_path);
+      return false;
+    }
+
+    write_json(file, options, results, count);
+    fclose(file);
+  }
+
+  return true;
+}
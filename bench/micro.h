@@ -0,0 +1,12 @@
+#pragma once
+
+#include "base.h"
+
+typedef struct {
+  int warmup;
+  int reps;
+  char* only; // run a single microbenchmark, NULL for all
+  char* json_path; // also write the results here, optional
+} micro_options_t;
+
+bool run_microbenchmarks(micro_options_t* options);
@@ -12,6 +12,21 @@ typedef enum {
 } cb_node_kind_t;
 #undef X
 
+#define X(name, ...) CB_PASS_##name,
+typedef enum {
+  #include "pass.def"
+  NUM_CB_PASSES,
+} cb_pass_t;
+#undef X
+
+// each analysis needs every one listed before it
+#define X(name, ...) CB_ANALYSIS_##name,
+typedef enum {
+  #include "analysis.def"
+  NUM_CB_ANALYSES,
+} cb_analysis_t;
+#undef X
+
 typedef struct cringe_arena_t cb_arena_t;
 typedef struct cb_opt_context_t cb_opt_context_t; // exists to prevent constant reallocation of dynamic arrays
 
@@ -47,14 +62,6 @@ struct cb_use_t {
   int index;
 };
 
-typedef struct {
-  cb_arena_t* arena;
-  int next_id;
-  int next_alloca_id;
-
-  cb_node_t *start, *end;
-} cb_func_t;
-
 typedef struct {
   cb_node_t* start_ctrl;
   cb_node_t* start_mem;
@@ -72,6 +79,24 @@ typedef struct {
 } cb_ins_iterator_t;
 
 typedef struct cb_block_t cb_block_t;
+
+typedef struct cb_loop_t cb_loop_t;
+struct cb_loop_t {
+  int id;
+  cb_loop_t* parent;
+  int depth; // 1 for outermost loops
+
+  cb_block_t* header; // first block of the loop reached from the entry
+  cb_block_t* preheader; // NULL unless the header has a single predecessor outside the loop that only jumps to it
+  bool is_irreducible; // some block other than the header is entered from outside
+
+  int block_count;
+  cb_block_t** blocks; // including those of nested loops
+
+  int exit_count;
+  cb_block_t** exits; // blocks outside the loop with a predecessor inside it
+};
+
 struct cb_block_t {
   int id;
   cb_block_t* next;
@@ -86,9 +111,14 @@ struct cb_block_t {
   int dom_children_count;
   cb_block_t** dom_children;
 
-  uint64_t* dom_set;
+  int dom_pre; // a dominates b iff a's [pre, post] interval contains b's
+  int dom_post;
   int dom_depth;
 
+  int dom_jump_count;
+  cb_block_t** dom_jump; // dom_jump[k] is the 2^k-th dominator up the tree
+
+  cb_loop_t* loop; // innermost loop containing this block
   int loop_nesting;
 
   int node_count;
@@ -106,8 +136,29 @@ typedef struct {
   cb_block_t** map;
   cb_anti_dep_t** anti_deps;
   int block_count;
+  int loop_count;
+  cb_loop_t** loops; // innermost first
 } cb_gcm_result_t;
 
+typedef struct {
+  int version[NUM_CB_ANALYSES]; // graph version each analysis was computed at, 0 if never
+  cb_block_t** initial_map; // pinned node -> block, from building the cfg
+  cb_gcm_result_t gcm; // filled in one analysis at a time
+} cb_analyses_t;
+
+typedef struct {
+  cb_arena_t* arena;
+  int next_id;
+  int next_alloca_id;
+
+  int register_count; // how many values the local scheduler may keep live, 0 for no limit
+
+  int version; // bumped whenever an edge of the graph changes
+  cb_analyses_t analyses; // cached results, only good while their version matches
+
+  cb_node_t *start, *end;
+} cb_func_t;
+
 cb_arena_t* cb_new_arena();
 void cb_free_arena(cb_arena_t* arena);
 
@@ -145,11 +196,45 @@ void cb_graphviz_func(FILE* stream, cb_func_t* func);
 cb_opt_context_t* cb_new_opt_context();
 void cb_free_opt_context(cb_opt_context_t* opt);
 
+typedef struct {
+  bool enabled[NUM_CB_PASSES];
+  int max_runs[NUM_CB_PASSES]; // 0 means no limit
+} cb_opt_options_t;
+
+cb_opt_options_t cb_opt_level_options(int level); // passes in pass.def at or below level are enabled
+
+typedef enum {
+  CB_REGALLOC_GRAPH_COLORING,
+  CB_REGALLOC_LINEAR_SCAN, // a single pass over live intervals, for when compile speed matters more than the code
+} cb_regalloc_t;
+
+cb_regalloc_t cb_opt_level_regalloc(int level);
+void cb_set_opt_options(cb_opt_context_t* opt, cb_opt_options_t* options);
+
+char* cb_node_kind_label(cb_node_kind_t kind);
+
+char* cb_pass_label(cb_pass_t pass);
+cb_pass_t cb_find_pass(char* label); // NUM_CB_PASSES if there is no such pass
+
 void cb_opt_func(cb_opt_context_t* opt, cb_func_t* func);
 
-cb_gcm_result_t cb_run_global_code_motion(cb_arena_t* arena, cb_func_t* func);
+typedef struct {
+  int pops;
+  int repushes; // pushes of a node that had already been popped
+  int max_pops_per_node;
+} cb_opt_stats_t;
+
+cb_opt_stats_t cb_get_opt_stats(cb_opt_context_t* opt); // from the most recent cb_opt_func
+
+void cb_require_analysis(cb_func_t* func, cb_analysis_t analysis); // only recomputes what the graph has changed under since
+cb_gcm_result_t cb_run_global_code_motion(cb_func_t* func); // requires the schedule, the result lives as long as func's arena
 
 void cb_dump_func(FILE* stream, cb_func_t* func);
 
 cb_func_t* cb_select_x64(cb_arena_t* arena, cb_func_t* func);
-void cb_generate_x64(cb_func_t* func);
\ No newline at end of file
+typedef struct {
+  size_t size;
+  uint8_t* bytes;
+} cb_code_t;
+
+cb_code_t cb_generate_x64(cb_arena_t* arena, FILE* stream /*optional*/, cb_func_t* func, cb_regalloc_t regalloc); // dumps the machine code before and after register allocation to stream
\ No newline at end of file
@@ -12,6 +12,7 @@ void cb_free_arena(cb_arena_t* arena) {
 cb_func_t* cb_new_func(cb_arena_t* arena) {
   cb_func_t* func = arena_type(arena, cb_func_t);
   func->arena = arena;
+  func->version = 1; // analyses at version 0 were never computed
 
   return func;
 }
@@ -43,6 +44,8 @@ static cb_node_t* new_node_unchecked(cb_func_t* func, cb_node_kind_t kind, int n
 
   init_ins(func, node, num_ins);
 
+  stats_count(STAT_NODES_CREATED, 1);
+
   if (node->kind == CB_NODE_START) {
     assert(!func->start);
     func->start = node;
@@ -65,6 +68,7 @@ void set_input(cb_func_t* func, cb_node_t* node, cb_node_t* input, int index) {
   assert(node->ins[index] == NULL);
 
   node->ins[index] = input;
+  func->version++;
 
   cb_use_t* use = arena_type(func->arena, cb_use_t);
   use->node = node;
@@ -309,6 +313,11 @@ static bool has_proj(cb_node_t* node) {
   return false;
 }
 
+char* cb_node_kind_label(cb_node_kind_t kind) {
+  assert(kind >= 0 && kind < NUM_CB_NODE_KINDS);
+  return node_kind_label[kind];
+}
+
 void cb_graphviz_func(FILE* stream, cb_func_t* func) {
   scratch_t scratch = scratch_get(0, NULL);
 
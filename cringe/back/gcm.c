@@ -30,70 +30,164 @@ static sched_item_t sched_item(bool processed, cb_node_t* node) {
   };
 }
 
-static cb_block_t* intersect(cb_block_t* f1, cb_block_t* f2) {
-  while (f1 != f2) {
-    while (f1->id > f2->id) {
-      f1 = f1->idom;
-    }
+typedef struct {
+  cb_block_t* block;
+  int next_successor;
+} dfs_item_t;
+
+typedef struct {
+  bool processed;
+  cb_block_t* block;
+} dom_item_t;
+
+static dom_item_t dom_item(bool processed, cb_block_t* block) {
+  return (dom_item_t) {
+    .processed = processed,
+    .block = block
+  };
+}
+
+typedef struct {
+  cb_block_t** vertex; // by preorder number
+  int* parent;
+  int* semi;
+  int* label;
+  int* ancestor; // -1 until linked into the forest
+  int* path;
+} semi_nca_t;
+
+// finds the vertex with the smallest semidominator on v's path in the forest, compressing the path as it goes
+static int semi_nca_eval(semi_nca_t* s, int v) {
+  if (s->ancestor[v] < 0) {
+    return v;
+  }
 
-    while (f2->id > f1->id) {
-      f2 = f2->idom;
+  int path_count = 0;
+
+  for (int u = v; s->ancestor[s->ancestor[u]] >= 0; u = s->ancestor[u]) {
+    s->path[path_count++] = u;
+  }
+
+  while (path_count) {
+    int u = s->path[--path_count];
+    int a = s->ancestor[u];
+
+    if (s->semi[s->label[a]] < s->semi[s->label[u]]) {
+      s->label[u] = s->label[a];
     }
+
+    s->ancestor[u] = s->ancestor[a];
   }
 
-  return f1;
+  return s->label[v];
 }
 
-static void build_dominator_tree(arena_t* arena, cb_block_t* cfg_head) {
-  scratch_t scratch = scratch_get(1, &arena);
+void compute_idoms(cb_block_t* cfg_head) {
+  // semi-nca: semidominators as in lengauer-tarjan, then each idom is the nearest common
+  // ancestor of the block's semidominator and dfs parent, found by walking the idoms built so far
+  // https://renatowerneck.files.wordpress.com/2016/06/gwtta04-dominator.pdf
 
-  // make dominance tree
-  // goated paper: https://www.cs.tufts.edu/~nr/cs257/archive/keith-cooper/dom14.pdf
+  scratch_t scratch = scratch_get(0, NULL);
 
-  cfg_head->idom = cfg_head;
+  int block_count = 0;
+  int max_id = 0;
 
-  for (;;) {
-    bool changed = false;
+  foreach_list (cb_block_t, b, cfg_head) {
+    block_count++;
+    max_id = b->id > max_id ? b->id : max_id;
+  }
 
-    foreach_list(cb_block_t, b, cfg_head->next) {// skip start
-      cb_block_t* first = NULL;
+  semi_nca_t s = {
+    .vertex = arena_array(scratch.arena, cb_block_t*, block_count),
+    .parent = arena_array(scratch.arena, int, block_count),
+    .semi = arena_array(scratch.arena, int, block_count),
+    .label = arena_array(scratch.arena, int, block_count),
+    .ancestor = arena_array(scratch.arena, int, block_count),
+    .path = arena_array(scratch.arena, int, block_count),
+  };
 
-      for (int i = 0; i < b->predecessor_count; ++i) {
-        cb_block_t* p = b->predecessors[i];
+  int* pre = arena_array(scratch.arena, int, max_id + 1);
 
-        if (p->idom) {
-          first = p;
-          break;
-        }
-      }
+  for (int i = 0; i <= max_id; ++i) {
+    pre[i] = -1;
+  }
 
-      assert(first != NULL);
-      cb_block_t* new_idom = first;;
+  dfs_item_t* stack = arena_array(scratch.arena, dfs_item_t, block_count);
+  int stack_count = 0;
+  int reached = 0;
 
-      for (int i = 0; i < b->predecessor_count; ++i) {
-        cb_block_t* p = b->predecessors[i];
-        if (p == first) {
-          continue;
-        }
+  pre[cfg_head->id] = reached;
+  s.vertex[reached++] = cfg_head;
+  stack[stack_count++] = (dfs_item_t) { .block = cfg_head };
 
-        if (p->idom) {
-          new_idom = intersect(p, new_idom);
-        }
+  while (stack_count) {
+    dfs_item_t* item = stack + stack_count - 1;
+
+    if (item->next_successor == item->block->successor_count) {
+      stack_count--;
+      continue;
+    }
+
+    cb_block_t* succ = item->block->successors[item->next_successor++];
+
+    if (pre[succ->id] >= 0) {
+      continue;
+    }
+
+    s.parent[reached] = pre[item->block->id];
+    pre[succ->id] = reached;
+    s.vertex[reached++] = succ;
+    stack[stack_count++] = (dfs_item_t) { .block = succ };
+  }
+
+  for (int v = 0; v < reached; ++v) {
+    s.semi[v] = v;
+    s.label[v] = v;
+    s.ancestor[v] = -1;
+  }
+
+  for (int w = reached-1; w > 0; --w) {
+    cb_block_t* block = s.vertex[w];
+
+    for (int i = 0; i < block->predecessor_count; ++i) {
+      int v = pre[block->predecessors[i]->id];
+
+      if (v < 0) { // unreachable
+        continue;
       }
 
-      if (b->idom != new_idom) {
-        b->idom = new_idom;
-        changed = true;
+      int u = semi_nca_eval(&s, v);
+
+      if (s.semi[u] < s.semi[w]) {
+        s.semi[w] = s.semi[u];
       }
     }
 
-    if (!changed) {
-      break;
+    s.label[w] = s.semi[w];
+    s.ancestor[w] = s.parent[w];
+  }
+
+  // reuse parent as the idom array, vertices before w already hold their final idom
+  int* idom = s.parent;
+
+  for (int w = 1; w < reached; ++w) {
+    while (idom[w] > s.semi[w]) {
+      idom[w] = idom[idom[w]];
     }
+
+    s.vertex[w]->idom = s.vertex[idom[w]];
   }
 
   cfg_head->idom = NULL;
 
+  scratch_release(&scratch);
+}
+
+void build_dominator_tree(arena_t* arena, cb_block_t* cfg_head) {
+  scratch_t scratch = scratch_get(1, &arena);
+
+  compute_idoms(cfg_head);
+
   int block_count = 0;
 
   foreach_list (cb_block_t, b, cfg_head) {
@@ -117,93 +211,335 @@ static void build_dominator_tree(arena_t* arena, cb_block_t* cfg_head) {
     }
   }
 
-  // calculate dominator tree depth
-  // fill dom sets
+  // number the dominator tree in pre and post order for dominance checks,
+  // calculate depth and the binary lifting tables for find_lca on the way down
+
+  dom_item_t* stack = arena_array(scratch.arena, dom_item_t, block_count * 2);
+  int stack_count = 0;
+  int next_number = 0;
 
-  vec_t(cb_block_t*) stack = NULL;
+  stack[stack_count++] = dom_item(false, cfg_head);
 
-  vec_put(stack, cfg_head);
+  while (stack_count) {
+    dom_item_t item = stack[--stack_count];
+    cb_block_t* b = item.block;
 
-  while (vec_len(stack)) {
-    cb_block_t* b = vec_pop(stack);
+    if (item.processed) {
+      b->dom_post = next_number++;
+      continue;
+    }
+
+    b->dom_pre = next_number++;
 
-    if (!b->dom_set) {
-      b->dom_set = bitset_alloc(arena, block_count);
+    if (b->idom) {
+      b->dom_depth = b->idom->dom_depth + 1;
 
-      if (b->idom) {
-        b->dom_depth = b->idom->dom_depth + 1;
+      while ((1 << b->dom_jump_count) <= b->dom_depth) {
+        b->dom_jump_count++;
       }
 
-      vec_put(stack, b);
+      b->dom_jump = arena_array(arena, cb_block_t*, b->dom_jump_count);
+      b->dom_jump[0] = b->idom;
 
-      for (int i = 0; i < b->dom_children_count; ++i) {
-        vec_put(stack, b->dom_children[i]);
+      for (int k = 1; k < b->dom_jump_count; ++k) {
+        b->dom_jump[k] = b->dom_jump[k-1]->dom_jump[k-1];
       }
     }
-    else {
-      for (int i = 0; i < b->dom_children_count; ++i) {
-        bitset_or(b->dom_set, b->dom_children[i]->dom_set, block_count);
-      }
 
-      bitset_set(b->dom_set, b->id); // every node dominates itself
+    stack[stack_count++] = dom_item(true, b);
+
+    for (int i = 0; i < b->dom_children_count; ++i) {
+      stack[stack_count++] = dom_item(false, b->dom_children[i]);
     }
   }
 
-  vec_free(stack);
   scratch_release(&scratch);
 }
 
-static void process_backedge(uint64_t* visited, cb_block_t** stack, int block_count, cb_block_t* from, cb_block_t* to) {
-  bitset_clear(visited, block_count);
-  
+static int loop_find(int* parents, int x) {
+  while (parents[x] != x) {
+    parents[x] = parents[parents[x]];
+    x = parents[x];
+  }
+
+  return x;
+}
+
+cb_loop_t** build_loop_forest(arena_t* arena, cb_block_t* cfg_head, int* out_loop_count) {
+  // havlak's loop forest with ramalingam's fix for irreducible loops, nearly linear thanks to union-find
+  // https://dl.acm.org/doi/10.1145/262004.262005
+  // https://dl.acm.org/doi/10.1145/570886.570887
+  // vertices are numbered in dfs preorder, w is an ancestor of v iff pre[w] <= pre[v] <= last[w]
+
+  scratch_t scratch = scratch_get(1, &arena);
+
+  int block_count = 0;
+
+  foreach_list (cb_block_t, b, cfg_head) {
+    b->loop = NULL;
+    b->loop_nesting = 0;
+    block_count++;
+  }
+
+  int* pre = arena_array(scratch.arena, int, block_count);
+  int* last = arena_array(scratch.arena, int, block_count);
+  cb_block_t** vertex = arena_array(scratch.arena, cb_block_t*, block_count);
+
+  for (int i = 0; i < block_count; ++i) {
+    pre[i] = -1;
+  }
+
+  dfs_item_t* stack = arena_array(scratch.arena, dfs_item_t, block_count);
   int stack_count = 0;
-  stack[stack_count++] = from;
-  bitset_set(visited, from->id);
+  int reached = 0;
 
-  // to dominates from, walk up graph to find loop
+  pre[cfg_head->id] = reached;
+  vertex[reached++] = cfg_head;
+  stack[stack_count++] = (dfs_item_t) { .block = cfg_head };
 
   while (stack_count) {
-    cb_block_t* block = stack[--stack_count];
+    dfs_item_t* item = stack + stack_count - 1;
 
-    block->loop_nesting++;
-
-    if (block == to) {
+    if (item->next_successor == item->block->successor_count) {
+      last[pre[item->block->id]] = reached - 1;
+      stack_count--;
       continue;
     }
 
+    cb_block_t* succ = item->block->successors[item->next_successor++];
+
+    if (pre[succ->id] < 0) {
+      pre[succ->id] = reached;
+      vertex[reached++] = succ;
+      stack[stack_count++] = (dfs_item_t) { .block = succ };
+    }
+  }
+
+  #define IS_ANCESTOR(w, v) ((w) <= (v) && (v) <= last[w])
+
+  int* parents = arena_array(scratch.arena, int, reached); // union-find, collapsed vertices point into their loop's header
+  int* mark = arena_array(scratch.arena, int, reached);
+  int* pool = arena_array(scratch.arena, int, reached);
+  vec_t(int)* irreducible_preds = arena_array(scratch.arena, vec_t(int), reached); // entries into a loop that bypass its header
+  cb_loop_t** header_loop = arena_array(scratch.arena, cb_loop_t*, reached);
+
+  for (int v = 0; v < reached; ++v) {
+    parents[v] = v;
+    mark[v] = -1;
+  }
+
+  vec_t(cb_loop_t*) loops = NULL;
+
+  for (int w = reached-1; w >= 0; --w) {
+    cb_block_t* block = vertex[w];
+
+    int pool_count = 0;
+    bool is_loop = false;
+    bool is_irreducible = false;
+
     for (int i = 0; i < block->predecessor_count; ++i) {
-      cb_block_t* p = block->predecessors[i];
+      int v = pre[block->predecessors[i]->id];
+
+      if (v < 0 || !IS_ANCESTOR(w, v)) {
+        continue;
+      }
 
-      if (bitset_get(visited, p->id)) {
+      if (v == w) {
+        is_loop = true;
         continue;
       }
 
-      stack[stack_count++] = p;
+      int x = loop_find(parents, v);
 
-      bitset_set(visited, p->id);
+      if (mark[x] != w) {
+        mark[x] = w;
+        pool[pool_count++] = x;
+      }
     }
+
+    // walk backwards from the back edges to collect the body
+
+    for (int i = 0; i < pool_count; ++i) {
+      int x = pool[i];
+      cb_block_t* x_block = vertex[x];
+
+      int pred_count = x_block->predecessor_count + (int)vec_len(irreducible_preds[x]);
+
+      for (int j = 0; j < pred_count; ++j) {
+        int y;
+
+        if (j < x_block->predecessor_count) {
+          y = pre[x_block->predecessors[j]->id];
+
+          if (y < 0 || IS_ANCESTOR(x, y)) { // back edges belong to the inner loop at x
+            continue;
+          }
+        }
+        else {
+          y = irreducible_preds[x][j - x_block->predecessor_count];
+        }
+
+        y = loop_find(parents, y);
+
+        if (!IS_ANCESTOR(w, y)) {
+          is_irreducible = true;
+          vec_put(irreducible_preds[w], y);
+        }
+        else if (y != w && mark[y] != w) {
+          mark[y] = w;
+          pool[pool_count++] = y;
+        }
+      }
+    }
+
+    if (!is_loop && !pool_count) {
+      continue;
+    }
+
+    cb_loop_t* loop = arena_type(arena, cb_loop_t);
+    loop->id = (int)vec_len(loops);
+    loop->header = block;
+    loop->is_irreducible = is_irreducible;
+
+    block->loop = loop;
+    header_loop[w] = loop;
+
+    for (int i = 0; i < pool_count; ++i) {
+      int x = pool[i];
+      parents[x] = w;
+
+      if (header_loop[x]) {
+        header_loop[x]->parent = loop;
+      }
+      else {
+        vertex[x]->loop = loop;
+      }
+    }
+
+    vec_put(loops, loop);
   }
-}
 
-// we'll use this info to influence where nodes are scheduled
-// TODO: handle non-natural loops????
-static void compute_loop_nesting(int block_count, cb_block_t* cfg_head) {
-  scratch_t scratch = scratch_get(0, NULL);
+  #undef IS_ANCESTOR
+
+  int loop_count = (int)vec_len(loops);
+
+  // loops are discovered innermost first, so walking backwards sees every parent before its children
+
+  for (int i = loop_count-1; i >= 0; --i) {
+    cb_loop_t* loop = loops[i];
+    loop->depth = loop->parent ? loop->parent->depth + 1 : 1;
+  }
+
+  // every loop's body is a slice of one array, its own blocks followed by the bodies of its children
+
+  int looped_block_count = 0;
+
+  foreach_list (cb_block_t, b, cfg_head) {
+    if (b->loop) {
+      b->loop_nesting = b->loop->depth;
+      b->loop->block_count++;
+      looped_block_count++;
+    }
+  }
+
+  int* direct_count = arena_array(scratch.arena, int, loop_count);
+
+  for (int i = 0; i < loop_count; ++i) {
+    direct_count[i] = loops[i]->block_count;
+  }
+
+  for (int i = 0; i < loop_count; ++i) {
+    if (loops[i]->parent) {
+      loops[i]->parent->block_count += loops[i]->block_count;
+    }
+  }
+
+  cb_block_t** bodies = arena_array(arena, cb_block_t*, looped_block_count);
+  int* cursor = arena_array(scratch.arena, int, loop_count); // where the next child's slice starts
+  int top_cursor = 0;
+
+  for (int i = loop_count-1; i >= 0; --i) {
+    cb_loop_t* loop = loops[i];
+
+    if (loop->parent) {
+      loop->blocks = loop->parent->blocks + cursor[loop->parent->id];
+      cursor[loop->parent->id] += loop->block_count;
+    }
+    else {
+      loop->blocks = bodies + top_cursor;
+      top_cursor += loop->block_count;
+    }
+
+    cursor[i] = direct_count[i];
+    direct_count[i] = 0;
+  }
+
+  foreach_list (cb_block_t, b, cfg_head) {
+    if (b->loop) {
+      b->loop->blocks[direct_count[b->loop->id]++] = b;
+    }
+  }
 
-  uint64_t* visited = bitset_alloc(scratch.arena, block_count);
-  cb_block_t** stack = arena_array(scratch.arena, cb_block_t*, block_count);
+  // a loop's exits are the successors of its body that it doesn't hold. the mark is stamped with the loop's id,
+  // so each target is taken once per loop without clearing anything between loops
+
+  int* exit_mark = arena_array(scratch.arena, int, block_count);
+
+  for (int i = 0; i < block_count; ++i) {
+    exit_mark[i] = -1;
+  }
 
-  foreach_list (cb_block_t, a, cfg_head) {
-    for (int i = 0; i < a->successor_count; ++i) {
-      cb_block_t* b = a->successors[i];
+  for (int i = 0; i < loop_count; ++i) {
+    cb_loop_t* loop = loops[i];
+    vec_t(cb_block_t*) exits = NULL;
 
-      if (bitset_get(b->dom_set, a->id)) {
-        process_backedge(visited, stack, block_count, a, b);
+    for (int j = 0; j < loop->block_count; ++j) {
+      cb_block_t* b = loop->blocks[j];
+
+      for (int k = 0; k < b->successor_count; ++k) {
+        cb_block_t* s = b->successors[k];
+
+        if (exit_mark[s->id] != i && !loop_contains(loop, s)) {
+          exit_mark[s->id] = i;
+          vec_put(exits, s);
+        }
+      }
+    }
+
+    loop->exit_count = (int)vec_len(exits);
+    loop->exits = exits ? vec_bake(arena, exits) : NULL;
+
+    if (loop->is_irreducible) {
+      continue;
+    }
+
+    cb_block_t* entry = NULL;
+    int entry_count = 0;
+
+    for (int j = 0; j < loop->header->predecessor_count; ++j) {
+      cb_block_t* p = loop->header->predecessors[j];
+
+      if (!loop_contains(loop, p)) {
+        entry = p;
+        entry_count++;
       }
     }
+
+    if (entry_count == 1 && entry->successor_count == 1) {
+      loop->preheader = entry;
+    }
+  }
+
+  cb_loop_t** result = loops ? vec_bake(arena, loops) : NULL;
+
+  for (int v = 0; v < reached; ++v) {
+    vec_free(irreducible_preds[v]);
   }
 
   scratch_release(&scratch);
+
+  *out_loop_count = loop_count;
+  return result;
 }
 
 static cb_block_t* build_cfg(arena_t* arena, cb_block_t** block_map, cb_func_t* func, int* out_block_count) {
@@ -212,7 +548,7 @@ static cb_block_t* build_cfg(arena_t* arena, cb_block_t** block_map, cb_func_t*
 
   scratch_t scratch = scratch_get(1, &arena);
 
-  cb_block_t* cfg_head = NULL;
+  int block_count = 0;
 
   vec_t(cfg_build_item_t) stack = NULL;
   uint64_t* visited = bitset_alloc(scratch.arena, func->next_id);
@@ -234,6 +570,7 @@ static cb_block_t* build_cfg(arena_t* arena, cb_block_t** block_map, cb_func_t*
 
       if (node->flags & CB_NODE_FLAG_STARTS_BASIC_BLOCK) {
         block = arena_type(arena, cb_block_t);
+        block_count++;
       }
 
       block_map[node->id] = block;
@@ -276,11 +613,6 @@ static cb_block_t* build_cfg(arena_t* arena, cb_block_t** block_map, cb_func_t*
     else {
       cb_block_t* block = block_map[node->id];
 
-      if (node->flags & CB_NODE_FLAG_STARTS_BASIC_BLOCK) {
-        block->next = cfg_head;
-        cfg_head = block;
-      }
-
       foreach_list(cb_use_t, use, node->uses) {
         if (!(use->node->flags & CB_NODE_FLAG_IS_CFG)) {
           continue;
@@ -292,17 +624,53 @@ static cb_block_t* build_cfg(arena_t* arena, cb_block_t** block_map, cb_func_t*
         if (s != block) {
           assert(block->successor_count < 2);
           block->successors[block->successor_count++] = s;
+
+          if (use->node->kind == CB_NODE_BRANCH_TRUE && block->successor_count == 2) { // true successor always goes first
+            block->successors[1] = block->successors[0];
+            block->successors[0] = s;
+          }
           s->predecessor_count++; // we need to allocate this after so count it
         }
       }
     }
   }
 
-  int next_block_id = 0;
+  // link and number the blocks in reverse post-order, everything downstream relies on it.
+  // the false successor is walked first so the true successor comes straight after the branch
+
+  cb_block_t* cfg_head = NULL;
+  int next_block_id = block_count;
+
+  dfs_item_t* block_stack = arena_array(scratch.arena, dfs_item_t, block_count);
+  int block_stack_count = 0;
+
+  block_stack[block_stack_count++] = (dfs_item_t) { .block = block_map[func->start->id] };
+  block_map[func->start->id]->id = -1;
+
+  while (block_stack_count) {
+    dfs_item_t* item = block_stack + block_stack_count - 1;
+    cb_block_t* block = item->block;
+
+    if (item->next_successor == block->successor_count) {
+      block->id = --next_block_id;
+      block->next = cfg_head;
+      cfg_head = block;
+      block_stack_count--;
+      continue;
+    }
+
+    cb_block_t* succ = block->successors[block->successor_count - 1 - item->next_successor++];
+
+    if (succ->id == 0) {
+      succ->id = -1; // on the stack
+      block_stack[block_stack_count++] = (dfs_item_t) { .block = succ };
+    }
+  }
+
+  assert(next_block_id == 0);
 
   // allocate them predecessor arrays
   foreach_list (cb_block_t, b, cfg_head) {
-    b->id = next_block_id++;
     b->predecessors = arena_array(arena, cb_block_t*, b->predecessor_count);
     b->predecessor_count = 0;
   }
@@ -315,14 +683,11 @@ static cb_block_t* build_cfg(arena_t* arena, cb_block_t** block_map, cb_func_t*
     }
   }
 
-  build_dominator_tree(arena, cfg_head);
-  compute_loop_nesting(next_block_id, cfg_head);
-  
   vec_free(stack);
   scratch_release(&scratch);
 
   if (out_block_count) {
-    *out_block_count = next_block_id;
+    *out_block_count = block_count;
   }
 
   return cfg_head;
@@ -419,20 +784,23 @@ static cb_block_t* find_lca(cb_block_t* a, cb_block_t* b) {
     return b;
   }
 
-  while (a->dom_depth > b->dom_depth) {
-    a = a->idom;
+  if (block_dominates(a, b)) {
+    return a;
   }
 
-  while (b->dom_depth > a->dom_depth) {
-    b = b->idom;
+  if (block_dominates(b, a)) {
+    return b;
   }
 
-  while (a != b) {
-    a = a->idom;
-    b = b->idom;
+  // lift a to the highest dominator that still doesn't dominate b, its idom is the lca
+
+  for (int k = a->dom_jump_count-1; k >= 0; --k) {
+    if (k < a->dom_jump_count && !block_dominates(a->dom_jump[k], b)) {
+      a = a->dom_jump[k];
+    }
   }
 
-  return a;
+  return a->idom;
 }
 
 static cb_block_t* get_use_block(cb_block_t** map, cb_use_t* use) {
@@ -528,12 +896,17 @@ static void late_sched(cb_arena_t* arena, cb_block_t** map, cb_anti_dep_t** anti
         lca = anti_dep_raise_lca(arena, anti_deps, lca, node, map, early);
       }
 
-      // between the early schedule and the lca, find the shallowest loop depth
+      // between the early schedule and the lca, find the shallowest loop depth. constants stay at the lca, they
+      // cost as much to materialize as to copy and hoisting one out of a loop keeps it live across all of it
 
       assert(lca);
       cb_block_t* best = lca;
 
       for(;;) {
+        if (node->flags & CB_NODE_FLAG_IS_LEAF) {
+          break;
+        }
+
         if (lca->loop_nesting < best->loop_nesting) {
           best = lca;
         }
@@ -572,58 +945,448 @@ static bool block_phi(cb_node_t* node) {
   return node->kind == CB_NODE_PHI;
 }
 
-static bool block_branch(cb_node_t* node) {
-  return node->kind == CB_NODE_BRANCH;
+static bool block_terminator(cb_node_t* node) {
+  return (node->flags & CB_NODE_FLAG_IS_CFG) && !(node->flags & (CB_NODE_FLAG_STARTS_BASIC_BLOCK | CB_NODE_FLAG_IS_PROJ));
 }
 
-static bool block_everything_else(cb_node_t* node) {
-  return !(block_starter(node) || block_phi(node) || block_branch(node));
+static bool block_body(cb_node_t* node) {
+  return !(block_starter(node) || block_phi(node) || block_terminator(node));
 }
 
-cb_gcm_result_t cb_run_global_code_motion(cb_arena_t* arena, cb_func_t* func) {
-  scratch_t scratch = scratch_get(1, &arena);
+// rough cycle counts for the list scheduler, anything missing takes one cycle
+static int node_latency[NUM_CB_NODE_KINDS] = {
+  [CB_NODE_LOAD] = 4,
+  [CB_NODE_MUL] = 3,
+  [CB_NODE_SDIV] = 26,
 
-  cb_block_t** initial_map = arena_array(scratch.arena, cb_block_t*, func->next_id);
+  [CB_NODE_X64_MOV32_RM] = 4,
+  [CB_NODE_X64_MUL32_RR] = 3,
+  [CB_NODE_X64_IDIV32_RR] = 26,
+};
 
-  int block_count = 0;
-  cb_block_t* cfg_head = build_cfg(arena, initial_map, func, &block_count);
+static int get_latency(cb_node_t* node) {
+  return node_latency[node->kind] ? node_latency[node->kind] : 1;
+}
+
+static bool defines_register(cb_node_t* node) {
+  return node->uses && node->kind != CB_NODE_ALLOCA && !(node->flags & (CB_NODE_FLAG_IS_CFG | CB_NODE_FLAG_PRODUCES_MEMORY));
+}
+
+typedef struct {
+  bool is_data;
+  int slot;
+} local_dep_t;
+
+static local_dep_t local_dep(bool is_data, int slot) {
+  return (local_dep_t) {
+    .is_data = is_data,
+    .slot = slot
+  };
+}
+
+typedef struct {
+  cb_anti_dep_t** anti_deps;
+  int register_count; // 0 if pressure doesn't matter
+  int* slot; // node id -> index in the block being scheduled, -1 for anything outside it
+} local_sched_t;
+
+// list scheduler over the body of one block. nodes are picked by critical path height, preferring ones whose
+// inputs have finished, until more values are live than there are registers, then by how much they shrink the live set
+static void local_sched(local_sched_t* ls, vec_t(cb_node_t*)* out, cb_node_t** body, int count) {
+  if (!count) {
+    return;
+  }
+
+  scratch_t scratch = scratch_get(0, NULL);
+
+  // values from other blocks get slots after the body, they are live on entry and never scheduled
+
+  vec_t(cb_node_t*) nodes = NULL;
+
+  for (int i = 0; i < count; ++i) {
+    ls->slot[body[i]->id] = i;
+    vec_put(nodes, body[i]);
+  }
+
+  for (int i = 0; i < count; ++i) {
+    for (int j = 0; j < body[i]->num_ins; ++j) {
+      cb_node_t* in = body[i]->ins[j];
+
+      if (in && ls->slot[in->id] < 0 && defines_register(in)) {
+        ls->slot[in->id] = (int)vec_len(nodes);
+        vec_put(nodes, in);
+      }
+    }
+  }
+
+  int node_count = (int)vec_len(nodes);
+
+  // collect the dependences, data edges come from ins and anti-dependences keep loads ahead of the stores that clobber them
+
+  vec_t(local_dep_t) deps = NULL;
+  int* dep_start = arena_array(scratch.arena, int, count + 1);
+
+  int* succ_start = arena_array(scratch.arena, int, count + 1);
+  int* pred_count = arena_array(scratch.arena, int, count);
+  int* remaining_uses = arena_array(scratch.arena, int, node_count);
+  bool* live_out = arena_array(scratch.arena, bool, node_count);
+
+  for (int i = 0; i < node_count; ++i) {
+    foreach_list (cb_use_t, use, nodes[i]->uses) {
+      int user = ls->slot[use->node->id];
+      live_out[i] |= user < 0 || user >= count;
+    }
+  }
+
+  for (int i = 0; i < count; ++i) {
+    cb_node_t* node = body[i];
+    dep_start[i] = (int)vec_len(deps);
+
+    for (int j = 0; j < node->num_ins; ++j) {
+      if (node->ins[j] && ls->slot[node->ins[j]->id] >= 0) {
+        vec_put(deps, local_dep(true, ls->slot[node->ins[j]->id]));
+      }
+    }
+
+    if (node->flags & CB_NODE_FLAG_PRODUCES_MEMORY) {
+      foreach_list (cb_anti_dep_t, ad, ls->anti_deps[node->id]) {
+        int load = ls->slot[ad->node->id];
+
+        if (load >= 0 && load < count) {
+          vec_put(deps, local_dep(false, load));
+        }
+      }
+    }
+  }
+
+  dep_start[count] = (int)vec_len(deps);
+
+  for (int i = 0; i < count; ++i) {
+    for (int d = dep_start[i]; d < dep_start[i+1]; ++d) {
+      int p = deps[d].slot;
+      remaining_uses[p] += deps[d].is_data;
+
+      if (p < count) {
+        succ_start[p + 1]++;
+        pred_count[i]++;
+      }
+    }
+  }
+
+  for (int i = 0; i < count; ++i) {
+    succ_start[i+1] += succ_start[i];
+  }
+
+  int* succs = arena_array(scratch.arena, int, succ_start[count]);
+  int* succ_fill = arena_array(scratch.arena, int, count);
+
+  for (int i = 0; i < count; ++i) {
+    for (int d = dep_start[i]; d < dep_start[i+1]; ++d) {
+      int p = deps[d].slot;
+
+      if (p < count) {
+        succs[succ_start[p] + succ_fill[p]++] = i;
+      }
+    }
+  }
+
+  // heights are filled in reverse topological order so every user is done before its inputs.
+  // the post-order walk can't be trusted for this, phi cycles can put a user ahead of its input
+
+  int* order = arena_array(scratch.arena, int, count);
+  int* waiting = arena_array(scratch.arena, int, count);
+  int order_count = 0;
+
+  for (int i = 0; i < count; ++i) {
+    waiting[i] = pred_count[i];
+
+    if (!waiting[i]) {
+      order[order_count++] = i;
+    }
+  }
+
+  for (int o = 0; o < order_count; ++o) {
+    int p = order[o];
+
+    for (int e = succ_start[p]; e < succ_start[p+1]; ++e) {
+      if (--waiting[succs[e]] == 0) {
+        order[order_count++] = succs[e];
+      }
+    }
+  }
+
+  assert(order_count == count);
+
+  int* height = arena_array(scratch.arena, int, count);
+
+  for (int o = count-1; o >= 0; --o) {
+    int i = order[o];
+    int tallest = 0;
+
+    for (int e = succ_start[i]; e < succ_start[i+1]; ++e) {
+      tallest = height[succs[e]] > tallest ? height[succs[e]] : tallest;
+    }
+
+    height[i] = get_latency(body[i]) + tallest;
+  }
+
+  // constants don't wait on anything, picked by height they'd all be hoisted to the top of the block and stay live
+  // until their users. they're held back instead and placed right in front of the first user that gets picked
+
+  bool* deferred = arena_array(scratch.arena, bool, count);
+
+  for (int i = 0; i < count; ++i) {
+    if ((body[i]->flags & CB_NODE_FLAG_IS_LEAF) && succ_start[i] != succ_start[i+1]) {
+      deferred[i] = true;
+
+      for (int e = succ_start[i]; e < succ_start[i+1]; ++e) {
+        pred_count[succs[e]]--;
+      }
+    }
+  }
+
+  int* ready = arena_array(scratch.arena, int, count);
+  int* ready_cycle = arena_array(scratch.arena, int, count);
+  int ready_count = 0;
+
+  for (int i = 0; i < count; ++i) {
+    if (!pred_count[i] && !deferred[i]) {
+      ready[ready_count++] = i;
+    }
+  }
+
+  int cycle = 0;
+  int live_count = node_count - count;
+
+  for (int scheduled = 0; scheduled < count; ++scheduled) { // deferred constants count when they're placed
+    bool high_pressure = ls->register_count && live_count >= ls->register_count - 1;
+
+    int best = -1;
+    int best_delta = 0;
+
+    for (int r = 0; r < ready_count; ++r) {
+      int i = ready[r];
+      cb_node_t* node = body[i];
+
+      int delta = defines_register(node);
+
+      for (int d = dep_start[i]; d < dep_start[i+1]; ++d) { // inputs this is the last use of
+        int p = deps[d].slot;
+        delta -= deps[d].is_data && remaining_uses[p] == 1 && !live_out[p] && defines_register(nodes[p]);
+        delta += p < count && deferred[p] && defines_register(nodes[p]);
+      }
+
+      if (best < 0) {
+        best = r;
+        best_delta = delta;
+        continue;
+      }
+
+      int b = ready[best];
+
+      bool stalls = ready_cycle[i] > cycle;
+      bool best_stalls = ready_cycle[b] > cycle;
+
+      bool better;
+
+      if (high_pressure && delta != best_delta) {
+        better = delta < best_delta;
+      }
+      else if (stalls != best_stalls) {
+        better = !stalls;
+      }
+      else if (height[i] != height[b]) {
+        better = height[i] > height[b];
+      }
+      else if (delta != best_delta) {
+        better = delta < best_delta;
+      }
+      else {
+        better = i < b; // fall back on post-order
+      }
+
+      if (better) {
+        best = r;
+        best_delta = delta;
+      }
+    }
+
+    int i = ready[best];
+    ready[best] = ready[--ready_count];
+
+    for (int d = dep_start[i]; d < dep_start[i+1]; ++d) {
+      int p = deps[d].slot;
+
+      if (p < count && deferred[p]) {
+        deferred[p] = false;
+        vec_put(*out, body[p]);
+        scheduled++;
+        cycle++;
+      }
+    }
+
+    cb_node_t* node = body[i];
+    vec_put(*out, node);
+
+    cycle = (ready_cycle[i] > cycle ? ready_cycle[i] : cycle) + 1;
+    live_count += best_delta;
+
+    for (int d = dep_start[i]; d < dep_start[i+1]; ++d) {
+      remaining_uses[deps[d].slot] -= deps[d].is_data;
+    }
+
+    for (int e = succ_start[i]; e < succ_start[i+1]; ++e) {
+      int user = succs[e];
+      int available = cycle - 1 + get_latency(node);
+
+      ready_cycle[user] = available > ready_cycle[user] ? available : ready_cycle[user];
+
+      if (--pred_count[user] == 0) {
+        ready[ready_count++] = user;
+      }
+    }
+  }
+
+  for (int i = 0; i < node_count; ++i) {
+    ls->slot[nodes[i]->id] = -1;
+  }
+
+  vec_free(nodes);
+  vec_free(deps);
+  scratch_release(&scratch);
+}
+
+static void schedule(cb_func_t* func) {
+  cb_arena_t* arena = func->arena;
+  cb_analyses_t* an = &func->analyses;
+  cb_block_t* cfg_head = an->gcm.cfg;
+  int block_count = an->gcm.block_count;
+
+  scratch_t scratch = scratch_get(1, &arena);
 
   cb_anti_dep_t** anti_deps = arena_array(arena, cb_anti_dep_t*, func->next_id);
 
   func_walk_t pinned = get_pinned_nodes(scratch.arena, func);
 
   cb_block_t** early = arena_array(arena, cb_block_t*, func->next_id);
-  early_sched(early, initial_map, pinned, cfg_head);
+  trace_begin("early_sched", NULL);
+  early_sched(early, an->initial_map, pinned, cfg_head);
+  trace_end();
 
   cb_block_t** late = arena_array(arena, cb_block_t*, func->next_id);
+  trace_begin("late_sched", NULL);
   late_sched(arena, late, anti_deps, early, pinned, func);
+  trace_end();
 
   vec_t(cb_node_t*)* code = arena_array(scratch.arena, vec_t(cb_node_t*), block_count);
 
   func_walk_t walk = func_walk_post_order_ins(scratch.arena, func, anti_deps);
 
+  vec_t(cb_node_t*)* body = arena_array(scratch.arena, vec_t(cb_node_t*), block_count);
+
   put_code(&walk, late, block_starter, code);
   put_code(&walk, late, block_phi, code);
-  put_code(&walk, late, block_everything_else, code);
-  put_code(&walk, late, block_branch, code);
+  put_code(&walk, late, block_body, body);
+
+  local_sched_t ls = {
+    .anti_deps = anti_deps,
+    .register_count = func->register_count,
+    .slot = arena_array(scratch.arena, int, func->next_id)
+  };
+
+  for (int i = 0; i < func->next_id; ++i) {
+    ls.slot[i] = -1;
+  }
+
+  trace_begin("local_sched", NULL);
+
+  foreach_list(cb_block_t, b, cfg_head) {
+    local_sched(&ls, &code[b->id], body[b->id], (int)vec_len(body[b->id]));
+    vec_free(body[b->id]);
+  }
+
+  trace_end();
+
+  put_code(&walk, late, block_terminator, code);
 
   foreach_list(cb_block_t, b, cfg_head) {
     b->node_count = (int)vec_len(code[b->id]);
     b->nodes = vec_bake(arena, code[b->id]);
   }
 
-  return (cb_gcm_result_t) {
-    .cfg = cfg_head,
-    .map = late,
-    .anti_deps = anti_deps,
-    .block_count = block_count
-  };
+  scratch_release(&scratch);
+
+  an->gcm.map = late;
+  an->gcm.anti_deps = anti_deps;
 }
 
-void cb_dump_func(FILE* stream, cb_func_t* func) {
-  scratch_t scratch = scratch_get(0, NULL);
+static void run_analysis(cb_func_t* func, cb_analysis_t analysis) {
+  cb_arena_t* arena = func->arena;
+  cb_analyses_t* an = &func->analyses;
+
+  switch (analysis) {
+    default:
+      assert(false);
+      break;
+
+    case CB_ANALYSIS_CFG: {
+      an->gcm = (cb_gcm_result_t) { 0 };
+      an->initial_map = arena_array(arena, cb_block_t*, func->next_id);
+
+      trace_begin("build_cfg", NULL);
+      an->gcm.cfg = build_cfg(arena, an->initial_map, func, &an->gcm.block_count);
+      trace_end();
+    } break;
+
+    case CB_ANALYSIS_DOM_TREE: {
+      trace_begin("build_dominator_tree", NULL);
+      build_dominator_tree(arena, an->gcm.cfg);
+      trace_end();
+    } break;
+
+    case CB_ANALYSIS_LOOP_FOREST: {
+      trace_begin("build_loop_forest", NULL);
+      an->gcm.loops = build_loop_forest(arena, an->gcm.cfg, &an->gcm.loop_count);
+      trace_end();
+    } break;
+
+    case CB_ANALYSIS_SCHEDULE: {
+      schedule(func);
+    } break;
+  }
+}
+
+void cb_require_analysis(cb_func_t* func, cb_analysis_t analysis) {
+  cb_analyses_t* an = &func->analyses;
+
+  if (an->version[analysis] == func->version) {
+    stats_count(STAT_ANALYSIS_CACHE_HITS, 1);
+    return;
+  }
+
+  stats_begin_phase(STAT_PHASE_GCM);
+  trace_begin("gcm", NULL);
 
-  cb_gcm_result_t gcm = cb_run_global_code_motion(scratch.arena, func);
+  // everything is invalidated together, so the stale ones are a suffix of the ones needed
+
+  for (int i = 0; i <= analysis; ++i) {
+    if (an->version[i] != func->version) {
+      run_analysis(func, i);
+      an->version[i] = func->version;
+    }
+  }
+
+  trace_end();
+  stats_end_phase(STAT_PHASE_GCM);
+}
+
+cb_gcm_result_t cb_run_global_code_motion(cb_func_t* func) {
+  cb_require_analysis(func, CB_ANALYSIS_SCHEDULE);
+  return func->analyses.gcm;
+}
+
+void cb_dump_func(FILE* stream, cb_func_t* func) {
+  cb_gcm_result_t gcm = cb_run_global_code_motion(func);
 
   int num_blocks = 0;
   foreach_list(cb_block_t, b, gcm.cfg) {
@@ -674,6 +1437,4 @@ void cb_dump_func(FILE* stream, cb_func_t* func) {
   }
 
   fprintf(stream, "\n");
-
-  scratch_release(&scratch);
 }
\ No newline at end of file
@@ -2,9 +2,19 @@
 
 #include "internal.h"
 
-#define MAX_LOAD_FACTOR 0.5f
+// robin hood open addressing - entries in a probe run are kept ordered by their
+// distance from home, so misses terminate early and removal can shift the run back
+// instead of leaving tombstones behind
 
-#define TOMBSTONE ((cb_node_t*)0x1)
+#define MAX_LOAD_FACTOR 0.75f
+
+typedef struct {
+  arena_t* arena;
+  vec_t(gvn_op_t)* ops;
+  vec_t(cb_node_t*) snapshots; // latest snapshot of each node id, so removes hit what their get inserted
+} gvn_recorder_t;
+
+static gvn_recorder_t recorder;
 
 static uint64_t hash_node(cb_node_t* node) {
   uint64_t hash = FNV1_OFFSET_BASIS;
@@ -35,89 +45,192 @@ static bool nodes_ident(cb_node_t* a, cb_node_t* b, bool by_ptr) {
          memcmp(DATA(a, void), DATA(b, void), a->data_size) == 0;
 }
 
-static int find(gvn_table_t* table, cb_node_t* node, bool by_ptr) {
+static int home_slot(gvn_table_t* table, uint64_t hash) {
+  return (int)(hash & (uint64_t)(table->capacity - 1));
+}
+
+static int probe_distance(gvn_table_t* table, uint64_t hash, int slot) {
+  return (slot - home_slot(table, hash)) & (table->capacity - 1);
+}
+
+static int find(gvn_table_t* table, cb_node_t* node, uint64_t hash, bool by_ptr) {
   if (!table->capacity) {
-    return INT32_MAX;
+    return -1;
   }
 
-  int i = hash_node(node) % table->capacity;
+  int i = home_slot(table, hash);
 
-  int first_empty = -1;
+  for (int dist = 0;; ++dist) {
+    gvn_slot_t* slot = table->slots + i;
 
-  for (int j = 0; j < table->capacity; ++j) {
-    switch ((size_t)table->table[i])
-    {
-      case NULL:
-        if (first_empty == -1) {
-          first_empty = i;
-        }
-        return first_empty;
-
-      case TOMBSTONE:
-        if (first_empty == -1) {
-          first_empty = i;
-        }
-        break;
+    // a richer entry means ours would have been placed before it
+    if (!slot->node || probe_distance(table, slot->hash, i) < dist) {
+      return -1;
+    }
 
-      default: {
-        if (nodes_ident(table->table[i], node, by_ptr)) {
-          return i;
-        }
-      }
+    if (slot->hash == hash && nodes_ident(slot->node, node, by_ptr)) {
+      return i;
     }
 
-    i = (i + 1) % table->capacity;
+    i = (i + 1) & (table->capacity - 1);
   }
+}
+
+static void insert(gvn_table_t* table, gvn_slot_t entry) {
+  int i = home_slot(table, entry.hash);
+  int dist = 0;
+
+  for (;;) {
+    gvn_slot_t* slot = table->slots + i;
+
+    if (!slot->node) {
+      *slot = entry;
+      table->count++;
+      return;
+    }
+
+    int slot_dist = probe_distance(table, slot->hash, i);
+
+    if (slot_dist < dist) { // take from the rich
+      gvn_slot_t temp = *slot;
+      *slot = entry;
+      entry = temp;
+      dist = slot_dist;
+    }
 
-  return INT32_MAX;
+    i = (i + 1) & (table->capacity - 1);
+    dist++;
+  }
 }
 
-cb_node_t* gvn_get(gvn_table_t* table, cb_node_t* node) {
-  if (!table->capacity || (float)table->count > (float)table->capacity * MAX_LOAD_FACTOR) {
-    int new_capacity = table->capacity ? table->capacity * 2 : 8;
-
-    gvn_table_t new_table = {
-      .capacity = new_capacity,
-      .table = calloc(new_capacity, sizeof(cb_node_t*))
-    };
-
-    for (int i = 0; i < table->capacity; ++i) {
-      if (table->table[i] == TOMBSTONE || table->table[i] == NULL) {
-        continue;
-      }
-
-      int idx = find(&new_table, table->table[i], true);
-      new_table.table[idx] = table->table[i];
-      new_table.count++;
+static void grow(gvn_table_t* table) {
+  int new_capacity = table->capacity ? table->capacity * 2 : 8;
+
+  gvn_table_t new_table = {
+    .capacity = new_capacity,
+    .slots = calloc(new_capacity, sizeof(gvn_slot_t))
+  };
+
+  for (int i = 0; i < table->capacity; ++i) {
+    if (table->slots[i].node) {
+      insert(&new_table, table->slots[i]); // hashes are cached so nothing gets rehashed
     }
+  }
+
+  gvn_free_table(table);
+  *table = new_table;
+}
+
+static cb_node_t* snapshot_node(cb_node_t* node) {
+  while (vec_len(recorder.snapshots) <= (size_t)node->id) {
+    vec_put(recorder.snapshots, NULL);
+  }
+
+  cb_node_t* snapshot = recorder.snapshots[node->id];
+
+  if (snapshot && nodes_ident(snapshot, node, false)) {
+    return snapshot;
+  }
+
+  snapshot = arena_push(recorder.arena, sizeof(cb_node_t) + node->data_size);
+  memcpy(snapshot, node, sizeof(cb_node_t) + node->data_size);
+
+  snapshot->uses = NULL;
 
-    gvn_free_table(table);
-    *table = new_table;
+  if (node->num_ins) {
+    snapshot->ins = arena_array(recorder.arena, cb_node_t*, node->num_ins);
+    memcpy(snapshot->ins, node->ins, node->num_ins * sizeof(node->ins[0]));
   }
 
-  int idx = find(table, node, false);
+  return recorder.snapshots[node->id] = snapshot;
+}
+
+static void record_op(gvn_op_kind_t kind, cb_node_t* node) {
+  gvn_op_t op = {
+    .kind = kind,
+    .node = node ? snapshot_node(node) : NULL
+  };
+
+  vec_put(*recorder.ops, op);
+}
 
-  if (table->table[idx] == TOMBSTONE || table->table[idx] == NULL) {
-    table->table[idx] = node;
-    table->count++;
+void gvn_record(arena_t* arena, vec_t(gvn_op_t)* ops) {
+  recorder.arena = arena;
+  recorder.ops = ops;
+
+  vec_free(recorder.snapshots);
+  recorder.snapshots = NULL;
+}
+
+cb_node_t* gvn_get(gvn_table_t* table, cb_node_t* node) {
+  if (recorder.ops) {
+    record_op(GVN_OP_GET, node);
   }
 
-  return table->table[idx];
+  uint64_t hash = hash_node(node);
+
+  int idx = find(table, node, hash, false);
+
+  if (idx != -1) {
+    return table->slots[idx].node;
+  }
+
+  if (!table->capacity || (float)(table->count + 1) > (float)table->capacity * MAX_LOAD_FACTOR) {
+    grow(table);
+  }
+
+  gvn_slot_t entry = {
+    .hash = hash,
+    .node = node
+  };
+
+  insert(table, entry);
+
+  return node;
 }
 
 void gvn_remove(gvn_table_t* table, cb_node_t* node) {
-  int x = find(table, node, true);
+  if (recorder.ops) {
+    record_op(GVN_OP_REMOVE, node);
+  }
 
-  if (x != INT32_MAX) {
-    table->table[x] = TOMBSTONE;
+  int i = find(table, node, hash_node(node), true);
+
+  if (i == -1) {
+    return;
   }
+
+  // backward shift deletion - pull the rest of the run one slot closer to home
+
+  for (;;) {
+    int next = (i + 1) & (table->capacity - 1);
+    gvn_slot_t* slot = table->slots + next;
+
+    if (!slot->node || probe_distance(table, slot->hash, next) == 0) {
+      break;
+    }
+
+    table->slots[i] = *slot;
+    i = next;
+  }
+
+  memset(table->slots + i, 0, sizeof(table->slots[i]));
+  table->count--;
 }
 
 void gvn_clear(gvn_table_t* table) {
+  if (recorder.ops) {
+    record_op(GVN_OP_CLEAR, NULL);
+    vec_clear(recorder.snapshots); // node ids start over with the next function
+  }
+
   table->count = 0;
-  memset(table->table, 0, table->capacity * sizeof(table->table[0]));
+
+  if (table->capacity) {
+    memset(table->slots, 0, table->capacity * sizeof(table->slots[0]));
+  }
 }
 
 void gvn_free_table(gvn_table_t* table) {
-  free(table->table);
-}
\ No newline at end of file
+  free(table->slots);
+}
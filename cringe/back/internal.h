@@ -1,6 +1,7 @@
 #pragma once
 
 #include "base.h"
+#include "instrument.h"
 #include "cb.h"
 
 enum {
@@ -64,6 +65,20 @@ inline bool_node_t bool_node(bool processed, cb_node_t* node) {
   };
 }
 
+inline bool block_dominates(cb_block_t* a, cb_block_t* b) {
+  return a->dom_pre <= b->dom_pre && b->dom_post <= a->dom_post;
+}
+
+inline bool loop_contains(cb_loop_t* loop, cb_block_t* block) {
+  for (cb_loop_t* l = block->loop; l && l->depth >= loop->depth; l = l->parent) {
+    if (l == loop) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 func_walk_t func_walk_post_order_ins(arena_t* arena, cb_func_t* func, cb_anti_dep_t** anti_deps /*optional*/);
 func_walk_t func_walk_unspecified_order(arena_t* arena, cb_func_t* func); // fastest due to no allocations
 
@@ -78,14 +93,19 @@ static char* node_kind_label[] = {
 cb_node_t* new_node(cb_func_t* func, cb_node_kind_t kind, int num_ins, int data_size, cb_node_flags_t flags);
 cb_node_t* new_leaf(cb_func_t* func, cb_node_kind_t kind, int data_size, cb_node_flags_t flags);
 
-cb_use_t* find_and_remove_use(cb_node_t* user, int index);
+cb_use_t* find_and_remove_use(cb_func_t* func, cb_node_t* user, int index); // bumps func->version
 
 void set_input(cb_func_t* func, cb_node_t* node, cb_node_t* input, int index);
 
+typedef struct {
+  uint64_t hash;
+  cb_node_t* node;
+} gvn_slot_t;
+
 typedef struct {
   int count;
-  int capacity;
-  cb_node_t** table;
+  int capacity; // power of two
+  gvn_slot_t* slots;
 } gvn_table_t;
 
 cb_node_t* gvn_get(gvn_table_t* table, cb_node_t* node);
@@ -93,4 +113,36 @@ void gvn_remove(gvn_table_t* table, cb_node_t* node);
 
 void gvn_clear(gvn_table_t* table);
 
-void gvn_free_table(gvn_table_t* table);
\ No newline at end of file
+void gvn_free_table(gvn_table_t* table);
+
+// bench/micro.c records the table traffic of real cb_opt_func runs and replays it. each recorded node is
+// a snapshot from the time of the call, since the optimizer goes on to mutate nodes once they're removed
+
+typedef enum {
+  GVN_OP_GET,
+  GVN_OP_REMOVE,
+  GVN_OP_CLEAR,
+} gvn_op_kind_t;
+
+typedef struct {
+  gvn_op_kind_t kind;
+  cb_node_t* node;
+} gvn_op_t;
+
+void gvn_record(arena_t* arena, vec_t(gvn_op_t)* ops); // NULL ops stops recording
+
+// Internals driven directly by the microbenchmarks in bench/micro.c.
+
+void compute_idoms(cb_block_t* cfg_head); // cfg_head must be the entry block
+void build_dominator_tree(arena_t* arena, cb_block_t* cfg_head);
+cb_loop_t** build_loop_forest(arena_t* arena, cb_block_t* cfg_head, int* out_loop_count); // block ids must be 0 to block_count-1
+
+typedef struct machine_func_t machine_func_t;
+
+machine_func_t* x64_build_machine_func(arena_t* arena, cb_func_t* func); // everything cb_generate_x64 does before register allocation
+int x64_machine_inst_count(machine_func_t* func);
+
+uint64_t** compute_live_out(arena_t* arena, machine_func_t* func);
+void x64_build_intf(machine_func_t* func); // builds the interference graph and throws it away
+void regalloc_try_color(arena_t* arena, machine_func_t* func);
+void regalloc_linear_scan(arena_t* arena, machine_func_t* func);
@@ -1,33 +1,117 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "internal.h"
 
+// nodes are popped in rank order, where ranks come from a post-order walk over inputs
+// so a node is idealized after its inputs have settled rather than before
+// queued ranks live in a bitset, so each word acts as a bucket of 64 ranks
+
+typedef struct {
+  vec_t(int) rank; // indexed by node id, -1 if not ranked yet
+  vec_t(int) pop_count; // indexed by node id
+  vec_t(cb_node_t*) ranked; // indexed by rank
+  vec_t(uint64_t) queued; // bitset indexed by rank
+  size_t first_word; // no ranks below this word are queued
+  int count;
+} worklist_t;
+
 typedef struct {
   vec_t(cb_node_t*) packed;
   vec_t(int) sparse;
-} worklist_t;
+} node_set_t;
 
 struct cb_opt_context_t {
   cb_func_t* func;
   worklist_t worklist;
   vec_t(bool_node_t) stack; // reset locally and used for recursive stuff
   gvn_table_t gvn_table;
+  cb_opt_stats_t stats;
+  cb_opt_options_t options;
+
+  // memory effects whose set of observing loads may have shrunk since the last dse round
+  node_set_t dse_dirty;
+  vec_t(cb_node_t*) dse_stack;
+  vec_t(cb_node_t*) dse_visited;
 };
 
+static bool node_set_add(node_set_t* set, cb_node_t* node) {
+  while (node->id >= vec_len(set->sparse)) {
+    vec_put(set->sparse, -1);
+  }
+
+  if (set->sparse[node->id] != -1) {
+    return false;
+  }
+
+  set->sparse[node->id] = (int)vec_len(set->packed);
+  vec_put(set->packed, node);
+
+  return true;
+}
+
+static void node_set_remove(node_set_t* set, cb_node_t* node) {
+  if (node->id >= vec_len(set->sparse) || set->sparse[node->id] == -1) {
+    return;
+  }
+
+  int index = set->sparse[node->id];
+  cb_node_t* last = set->packed[index] = vec_pop(set->packed);
+
+  set->sparse[last->id] = index;
+  set->sparse[node->id] = -1;
+}
+
+static void node_set_clear(node_set_t* set) {
+  for (size_t i = 0; i < vec_len(set->packed); ++i) {
+    set->sparse[set->packed[i]->id] = -1;
+  }
+
+  vec_clear(set->packed);
+}
+
+static void node_set_free(node_set_t* set) {
+  vec_free(set->packed);
+  vec_free(set->sparse);
+}
+
+static int worklist_rank(worklist_t* w, cb_node_t* node) {
+  while (node->id >= vec_len(w->rank)) {
+    vec_put(w->rank, -1);
+    vec_put(w->pop_count, 0);
+  }
+
+  if (w->rank[node->id] == -1) { // nodes created during optimization go to the back
+    w->rank[node->id] = (int)vec_len(w->ranked);
+    vec_put(w->ranked, node);
+
+    if (vec_len(w->ranked) > vec_len(w->queued) * 64) {
+      vec_put(w->queued, 0);
+    }
+  }
+
+  return w->rank[node->id];
+}
+
 static void worklist_add(cb_opt_context_t* opt, cb_node_t* node) {
   worklist_t* w = &opt->worklist;
 
-  while (node->id >= vec_len(w->sparse)) {
-    vec_put(w->sparse, -1);
-  }
+  int rank = worklist_rank(w, node);
 
-  if (w->sparse[node->id] != -1) {
+  if (bitset_get(w->queued, rank)) {
     return;
   }
 
-  int index = (int)vec_len(w->packed);
-  w->sparse[node->id] = index;
-  vec_put(w->packed, node);
+  bitset_set(w->queued, rank);
+  w->count++;
+
+  if (rank / 64 < w->first_word) {
+    w->first_word = rank / 64;
+  }
+
+  if (w->pop_count[node->id]) {
+    opt->stats.repushes++;
+  }
 }
 
 static void worklist_remove(cb_opt_context_t* opt, cb_node_t* node) {
@@ -35,56 +119,88 @@ static void worklist_remove(cb_opt_context_t* opt, cb_node_t* node) {
 
   gvn_remove(&opt->gvn_table, node);
 
-  if (node->id >= vec_len(w->sparse)) {
+  if (node->id >= vec_len(w->rank)) {
     return;
   }
 
-  if (w->sparse[node->id] == -1) {
+  int rank = w->rank[node->id];
+
+  if (rank == -1 || !bitset_get(w->queued, rank)) {
     return;
   }
 
-  int index = w->sparse[node->id];
-  cb_node_t* last = w->packed[index] = vec_pop(w->packed);
-
-  w->sparse[last->id] = index;
-  w->sparse[node->id] = -1;
+  bitset_unset(w->queued, rank);
+  w->count--;
 }
 
 static cb_node_t* worklist_pop(cb_opt_context_t* opt) {
   worklist_t* w = &opt->worklist;
-  assert(vec_len(w->packed));
+  assert(w->count);
+
+  while (!w->queued[w->first_word]) {
+    w->first_word++;
+  }
 
-  cb_node_t* node = vec_pop(w->packed);
-  w->sparse[node->id] = -1;
+  int rank = (int)w->first_word * 64 + ctz64(w->queued[w->first_word]);
+
+  bitset_unset(w->queued, rank);
+  w->count--;
+
+  cb_node_t* node = w->ranked[rank];
+  int pops = ++w->pop_count[node->id];
+
+  opt->stats.pops++;
+
+  if (pops > opt->stats.max_pops_per_node) {
+    opt->stats.max_pops_per_node = pops;
+  }
 
   return node;
 }
 
 static bool worklist_empty(cb_opt_context_t* opt) {
-  return vec_len(opt->worklist.packed) == 0;
+  return opt->worklist.count == 0;
 }
 
 cb_opt_context_t* cb_new_opt_context() {
   cb_opt_context_t* opt = calloc(1, sizeof(cb_opt_context_t));
+  opt->options = cb_opt_level_options(2);
   return opt;
 }
 
 void cb_free_opt_context(cb_opt_context_t* opt) {
-  vec_free(opt->worklist.packed);
-  vec_free(opt->worklist.sparse);
+  vec_free(opt->worklist.rank);
+  vec_free(opt->worklist.pop_count);
+  vec_free(opt->worklist.ranked);
+  vec_free(opt->worklist.queued);
   vec_free(opt->stack);
 
+  node_set_free(&opt->dse_dirty);
+  vec_free(opt->dse_stack);
+  vec_free(opt->dse_visited);
+
   gvn_free_table(&opt->gvn_table);
 
   free(opt);
 }
 
+cb_opt_stats_t cb_get_opt_stats(cb_opt_context_t* opt) {
+  return opt->stats;
+}
+
 static void reset_context(cb_opt_context_t* opt, cb_func_t* func) {
-  vec_clear(opt->worklist.packed);
-  vec_clear(opt->worklist.sparse);
+  vec_clear(opt->worklist.rank);
+  vec_clear(opt->worklist.pop_count);
+  vec_clear(opt->worklist.ranked);
+  vec_clear(opt->worklist.queued);
+  opt->worklist.first_word = 0;
+  opt->worklist.count = 0;
   vec_clear(opt->stack);
+  vec_clear(opt->dse_dirty.packed);
+  vec_clear(opt->dse_dirty.sparse);
   opt->func = func;
   gvn_clear(&opt->gvn_table);
+  memset(&opt->stats, 0, sizeof(opt->stats));
 }
 
 typedef cb_node_t*(*idealize_func_t)(cb_opt_context_t*, cb_node_t*);
@@ -259,7 +375,9 @@ static idealize_func_t idealize_table[NUM_CB_NODE_KINDS] = {
   [CB_NODE_LOAD] = idealize_load,
 };
 
-cb_use_t* find_and_remove_use(cb_node_t* user, int index) {
+cb_use_t* find_and_remove_use(cb_func_t* func, cb_node_t* user, int index) {
+  func->version++; // analyses like the cfg walk the use lists, so losing a use is an edge change too
+
   for (cb_use_t** pu = &user->ins[index]->uses; *pu;) {
     cb_use_t* u = *pu;
 
@@ -277,6 +395,29 @@ cb_use_t* find_and_remove_use(cb_node_t* user, int index) {
   return NULL;
 }
 
+// called when a memory effect loses a user - any store upstream of it may have lost its last observer
+static void dse_mark_dirty(cb_opt_context_t* opt, cb_node_t* mem) {
+  vec_clear(opt->dse_stack);
+  vec_put(opt->dse_stack, mem);
+
+  while (vec_len(opt->dse_stack)) {
+    cb_node_t* node = vec_pop(opt->dse_stack);
+
+    // if it's already dirty, so is everything above it
+    if (!node_set_add(&opt->dse_dirty, node)) {
+      continue;
+    }
+
+    for (int i = 0; i < node->num_ins; ++i) {
+      cb_node_t* in = node->ins[i];
+
+      if (in && (in->flags & CB_NODE_FLAG_PRODUCES_MEMORY)) {
+        vec_put(opt->dse_stack, in);
+      }
+    }
+  }
+}
+
 static void remove_node(cb_opt_context_t* opt, cb_node_t* first) {
   vec_clear(opt->stack);
   vec_put(opt->stack, bool_node(false, first));
@@ -286,13 +427,20 @@ static void remove_node(cb_opt_context_t* opt, cb_node_t* first) {
     assert(node->uses == NULL);
 
     worklist_remove(opt, node);
+    node_set_remove(&opt->dse_dirty, node);
+
+    stats_count(STAT_NODES_KILLED, 1);
 
     for (int i = 0; i < node->num_ins; ++i) {
       if (!node->ins[i]) {
         continue;
       }
 
-      find_and_remove_use(node, i);
+      find_and_remove_use(opt->func, node, i);
+
+      if (node->ins[i]->flags & CB_NODE_FLAG_PRODUCES_MEMORY) {
+        dse_mark_dirty(opt, node->ins[i]);
+      }
 
       if (node->ins[i]->uses == NULL) {
         vec_put(opt->stack, bool_node(false, node->ins[i]));
@@ -305,6 +453,7 @@ static void remove_node(cb_opt_context_t* opt, cb_node_t* first) {
 
 static void replace_node(cb_opt_context_t* opt, cb_node_t* target, cb_node_t* source) {
   assert(target != source);
+  opt->func->version++;
 
   while (target->uses) {
     cb_use_t* use = target->uses;
@@ -337,7 +486,20 @@ static void peepholes(cb_opt_context_t* opt) {
       ideal = idealize(opt, node);
     }
 
-    ideal = gvn_get(&opt->gvn_table, ideal);
+    if (ideal != node) {
+      stats_count_idealized(node->kind);
+
+      if (node->kind == CB_NODE_LOAD) {
+        stats_count(STAT_LOADS_FORWARDED, 1);
+      }
+    }
+
+    cb_node_t* existing = gvn_get(&opt->gvn_table, ideal);
+
+    if (existing != ideal) {
+      stats_count(STAT_GVN_HITS, 1);
+      ideal = existing;
+    }
 
     if (ideal != node) {
       replace_node(opt, node, ideal);
@@ -346,85 +508,182 @@ static void peepholes(cb_opt_context_t* opt) {
 }
 
 typedef enum {
-  DSE_NO_LOADS,
+  DSE_UNKNOWN,
+  DSE_SEARCHING,
   DSE_LOADS,
+  DSE_NO_LOADS,
 } dse_state_t;
 
-static void dead_store_elim(cb_opt_context_t* opt) {
-  scratch_t scratch = scratch_get(0, NULL);
+static bool store_observed(cb_opt_context_t* opt, dse_state_t* states, cb_node_t* store) {
+  if (states[store->id] != DSE_UNKNOWN) {
+    return states[store->id] == DSE_LOADS;
+  }
 
-  dse_state_t* states = arena_array(scratch.arena, dse_state_t, opt->func->next_id);
+  bool observed = false;
 
-  int store_count = 0;
-  cb_node_t** stores = arena_array(scratch.arena, cb_node_t*, opt->func->next_id);
+  vec_clear(opt->dse_stack);
+  vec_clear(opt->dse_visited);
 
-  vec_clear(opt->stack);
+  vec_put(opt->dse_stack, store);
+  vec_put(opt->dse_visited, store);
+  states[store->id] = DSE_SEARCHING;
 
-  func_walk_t walk = func_walk_unspecified_order(scratch.arena, opt->func);
+  // walk down memory uses looking for anything that reads
+  while (!observed && vec_len(opt->dse_stack)) {
+    cb_node_t* node = vec_pop(opt->dse_stack);
 
-  // look for all nodes that read memory - add them to stack
-  // look for all stores - record them so we can potentially eliminate them
-  for (size_t i = 0; i < walk.len; ++i) {
-    cb_node_t* node = walk.nodes[i];
+    foreach_list(cb_use_t, use, node->uses) {
+      cb_node_t* user = use->node;
 
-    if (node->flags & CB_NODE_FLAG_READS_MEMORY) {
-      vec_put(opt->stack, bool_node(false, node));
-    }
+      if ((user->flags & CB_NODE_FLAG_READS_MEMORY) || states[user->id] == DSE_LOADS) {
+        observed = true;
+        break;
+      }
 
-    if (node->kind == CB_NODE_STORE) {
-      stores[store_count++] = node;
+      if (!(user->flags & CB_NODE_FLAG_PRODUCES_MEMORY) || states[user->id] != DSE_UNKNOWN) {
+        continue;
+      }
+
+      states[user->id] = DSE_SEARCHING;
+      vec_put(opt->dse_stack, user);
+      vec_put(opt->dse_visited, user);
     }
   }
 
-  // walk up dependency chains recording whether memory effects are observed
-  while (vec_len(opt->stack)) {
-    cb_node_t* node = vec_pop(opt->stack).node;
+  // an exhausted search proves nothing below any visited node is read either
+  for (size_t i = 0; i < vec_len(opt->dse_visited); ++i) {
+    states[opt->dse_visited[i]->id] = observed ? DSE_UNKNOWN : DSE_NO_LOADS;
+  }
 
-    if (states[node->id] == DSE_LOADS) {
-      continue;
-    }
+  if (observed) {
+    states[store->id] = DSE_LOADS;
+  }
 
-    states[node->id] = DSE_LOADS;
+  return observed;
+}
 
-    for (int i = 0; i < node->num_ins; ++i) {
-      cb_node_t* in = node->ins[i];
+static void dead_store_elim(cb_opt_context_t* opt) {
+  scratch_t scratch = scratch_get(0, NULL);
 
-      if (!in) {
-        continue;
-      }
+  dse_state_t* states = arena_array(scratch.arena, dse_state_t, opt->func->next_id);
 
-      if (in->flags & CB_NODE_FLAG_PRODUCES_MEMORY) {
-        vec_put(opt->stack, bool_node(false, in));
-      }
+  int store_count = 0;
+  cb_node_t** stores = arena_array(scratch.arena, cb_node_t*, vec_len(opt->dse_dirty.packed));
+
+  // only stores that may have lost an observer since the last round need looking at
+  for (size_t i = 0; i < vec_len(opt->dse_dirty.packed); ++i) {
+    cb_node_t* node = opt->dse_dirty.packed[i];
+
+    if (node->kind == CB_NODE_STORE) {
+      stores[store_count++] = node;
     }
   }
 
+  node_set_clear(&opt->dse_dirty);
+
   // remove any stores that don't have observable effects
   for (int i = 0; i < store_count; ++i) {
     cb_node_t* store = stores[i];
 
-    if (states[store->id] == DSE_NO_LOADS) {
+    if (!store->uses) { // already removed as part of an earlier replacement
+      continue;
+    }
+
+    if (!store_observed(opt, states, store)) {
       replace_node(opt, store, store->ins[STORE_MEM]);
+      stats_count(STAT_STORES_ELIMINATED, 1);
     }
   }
 
   scratch_release(&scratch);
 }
 
+typedef void(*pass_func_t)(cb_opt_context_t*);
+
+static pass_func_t pass_table[NUM_CB_PASSES] = {
+  [CB_PASS_PEEPHOLES] = peepholes,
+  [CB_PASS_DEAD_STORE_ELIM] = dead_store_elim,
+};
+
+#define X(name, label, ...) label,
+static char* pass_label[NUM_CB_PASSES] = {
+  #include "pass.def"
+};
+#undef X
+
+#define X(name, label, level) level,
+static int pass_level[NUM_CB_PASSES] = {
+  #include "pass.def"
+};
+#undef X
+
+cb_opt_options_t cb_opt_level_options(int level) {
+  cb_opt_options_t options = {0};
+
+  for (int i = 0; i < NUM_CB_PASSES; ++i) {
+    options.enabled[i] = pass_level[i] <= level;
+  }
+
+  return options;
+}
+
+cb_regalloc_t cb_opt_level_regalloc(int level) {
+  return level == 0 ? CB_REGALLOC_LINEAR_SCAN : CB_REGALLOC_GRAPH_COLORING;
+}
+
+void cb_set_opt_options(cb_opt_context_t* opt, cb_opt_options_t* options) {
+  opt->options = *options;
+}
+
+char* cb_pass_label(cb_pass_t pass) {
+  assert(pass >= 0 && pass < NUM_CB_PASSES);
+  return pass_label[pass];
+}
+
+cb_pass_t cb_find_pass(char* label) {
+  for (int i = 0; i < NUM_CB_PASSES; ++i) {
+    if (strcmp(pass_label[i], label) == 0) {
+      return (cb_pass_t)i;
+    }
+  }
+
+  return NUM_CB_PASSES;
+}
+
+static bool can_run_pass(cb_opt_context_t* opt, int* runs, cb_pass_t pass) {
+  int limit = opt->options.max_runs[pass];
+  return opt->options.enabled[pass] && (limit == 0 || runs[pass] < limit);
+}
+
 void cb_opt_func(cb_opt_context_t* opt, cb_func_t* func) {
   scratch_t scratch = scratch_get(0, NULL);
   reset_context(opt, func);
 
-  func_walk_t walk = func_walk_unspecified_order(scratch.arena, func);
+  func_walk_t walk = func_walk_post_order_ins(scratch.arena, func, NULL);
+
+  for (size_t i = 0; i < walk.len; ++i) {
+    worklist_rank(&opt->worklist, walk.nodes[i]);
+  }
 
   for (size_t i = 0; i < walk.len; ++i) {
     worklist_add(opt, walk.nodes[i]);
+
+    if (walk.nodes[i]->kind == CB_NODE_STORE) {
+      node_set_add(&opt->dse_dirty, walk.nodes[i]);
+    }
   }
 
+  int runs[NUM_CB_PASSES] = {0};
+
+  // passes run in pass.def order - keep going while peepholes have work left and are allowed to do it
   do {
-    peepholes(opt);
-    dead_store_elim(opt);
-  } while (!worklist_empty(opt));
+    for (int i = 0; i < NUM_CB_PASSES; ++i) {
+      if (can_run_pass(opt, runs, i)) {
+        pass_table[i](opt);
+        runs[i]++;
+      }
+    }
+  } while (!worklist_empty(opt) && can_run_pass(opt, runs, CB_PASS_PEEPHOLES));
 
   scratch_release(&scratch);
 }
\ No newline at end of file
@@ -26,10 +26,25 @@ typedef struct {
 
 typedef uint32_t reg_t;
 
+// coloring hands out the lowest free register, so the caller-saved ones come first
+// and a callee-saved register only costs a push and pop once a function needs it
+
 enum {
   PR_EAX,
   PR_ECX,
   PR_EDX,
+  PR_R8D,
+  PR_R9D,
+  PR_R10D,
+  PR_R11D,
+
+  PR_EBX,
+  PR_ESI,
+  PR_EDI,
+  PR_R12D,
+  PR_R13D,
+  PR_R14D,
+  PR_R15D,
 
   NUM_ALLOCATABLE_PRS,
   PR_ESP = NUM_ALLOCATABLE_PRS,
@@ -43,6 +58,17 @@ static char* pr_names32[NUM_PRS] = {
   "eax",
   "ecx",
   "edx",
+  "r8d",
+  "r9d",
+  "r10d",
+  "r11d",
+  "ebx",
+  "esi",
+  "edi",
+  "r12d",
+  "r13d",
+  "r14d",
+  "r15d",
   "esp",
   "ebp",
 };
@@ -51,10 +77,33 @@ static char* pr_names64[NUM_PRS] = {
   "rax",
   "rcx",
   "rdx",
+  "r8",
+  "r9",
+  "r10",
+  "r11",
+  "rbx",
+  "rsi",
+  "rdi",
+  "r12",
+  "r13",
+  "r14",
+  "r15",
   "rsp",
   "rbp",
 };
 
+// rsi and rdi are only callee-saved on windows, but code we emit runs under either abi
+static bool pr_callee_saved[NUM_PRS] = {
+  [PR_EBX] = true,
+  [PR_ESI] = true,
+  [PR_EDI] = true,
+  [PR_R12D] = true,
+  [PR_R13D] = true,
+  [PR_R14D] = true,
+  [PR_R15D] = true,
+  [PR_EBP] = true,
+};
+
 typedef struct alloca_t alloca_t;
 struct alloca_t {
   alloca_t* next;
@@ -95,13 +144,14 @@ struct machine_block_t {
   int loop_nesting;
 };
 
-typedef struct {
+struct machine_func_t {
   machine_block_t* block_head;
+  machine_block_t* exit_block;
   alloca_t* alloca_head;
   int next_alloca_id;
   int block_count;
   reg_t next_reg;
-} machine_func_t;
+};
 
 typedef struct {
   arena_t* arena;
@@ -305,6 +355,230 @@ static machine_block_t* get_branch_else(gen_context_t* g, cb_node_t* node) {
   return get_branch_dest(g, node, CB_NODE_BRANCH_FALSE);
 }
 
+typedef enum {
+  X64_MODRM_NONE,
+  X64_MODRM_REG,
+  X64_MODRM_MEM
+} x64_modrm_kind_t;
+
+typedef enum {
+  X64_IMM_NONE,
+  X64_IMM8,
+  X64_IMM32,
+  X64_IMM_SHRINK // imm8 with opcode bit 1 set when the value fits, otherwise imm32
+} x64_imm_kind_t;
+
+typedef struct {
+  int opcode_count;
+  uint8_t opcode[3];
+
+  bool rex_w;
+
+  x64_modrm_kind_t modrm;
+  int reg_digit;
+  reg_t reg;
+  reg_t rm;
+  alloca_t* mem;
+
+  reg_t opcode_reg;
+
+  x64_imm_kind_t imm_kind;
+  int32_t imm;
+
+  machine_block_t* target;
+  int short_opcode;
+} x64_encoding_t;
+
+typedef struct {
+  int at;
+  int size;
+  int branch;
+  machine_block_t* target;
+} x64_fixup_t;
+
+typedef struct {
+  vec_t(uint8_t) code;
+  int* block_offsets;
+  vec_t(x64_fixup_t) fixups;
+
+  int branch_count;
+  vec_t(bool) is_near; // per branch, set once its rel8 form is found not to reach
+} x64_encoder_t;
+
+static uint8_t pr_encoding[NUM_PRS] = {
+  [PR_EAX] = 0,
+  [PR_ECX] = 1,
+  [PR_EDX] = 2,
+  [PR_EBX] = 3,
+  [PR_ESP] = 4,
+  [PR_EBP] = 5,
+  [PR_ESI] = 6,
+  [PR_EDI] = 7,
+  [PR_R8D] = 8,
+  [PR_R9D] = 9,
+  [PR_R10D] = 10,
+  [PR_R11D] = 11,
+  [PR_R12D] = 12,
+  [PR_R13D] = 13,
+  [PR_R14D] = 14,
+  [PR_R15D] = 15,
+};
+
+static x64_encoding_t x64_encoding() {
+  return (x64_encoding_t) {
+    .reg_digit = -1,
+    .reg = NULL_REG,
+    .rm = NULL_REG,
+    .opcode_reg = NULL_REG,
+    .short_opcode = -1
+  };
+}
+
+static uint8_t encode_reg(reg_t reg) {
+  assert(reg < FIRST_VR && "register allocation must run before encoding");
+  return pr_encoding[reg];
+}
+
+static bool fits_in_int8(int32_t x) {
+  return x >= INT8_MIN && x <= INT8_MAX;
+}
+
+static void emit_u8(x64_encoder_t* e, uint8_t x) {
+  vec_put(e->code, x);
+}
+
+static void emit_u32(x64_encoder_t* e, uint32_t x) {
+  for (int i = 0; i < 4; ++i) {
+    emit_u8(e, (uint8_t)(x >> (i * 8)));
+  }
+}
+
+static void x64_encode(x64_encoder_t* e, x64_encoding_t* enc) {
+  if (enc->opcode_count == 0) {
+    return;
+  }
+
+  uint8_t reg = 0;
+  uint8_t rm = 0;
+
+  if (enc->modrm != X64_MODRM_NONE) {
+    reg = enc->reg_digit >= 0 ? (uint8_t)enc->reg_digit : encode_reg(enc->reg);
+    rm = enc->modrm == X64_MODRM_REG ? encode_reg(enc->rm) : pr_encoding[PR_EBP];
+  }
+  else if (enc->opcode_reg != NULL_REG) {
+    rm = encode_reg(enc->opcode_reg);
+  }
+
+  uint8_t rex = 0x40 | (enc->rex_w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+
+  if (rex != 0x40) {
+    emit_u8(e, rex);
+  }
+
+  uint8_t opcode[3];
+  memcpy(opcode, enc->opcode, sizeof(opcode));
+
+  x64_imm_kind_t imm_kind = enc->imm_kind;
+
+  if (imm_kind == X64_IMM_SHRINK) {
+    if (fits_in_int8(enc->imm)) {
+      opcode[enc->opcode_count-1] |= 2;
+      imm_kind = X64_IMM8;
+    }
+    else {
+      imm_kind = X64_IMM32;
+    }
+  }
+
+  if (enc->opcode_reg != NULL_REG) {
+    opcode[enc->opcode_count-1] |= rm & 7;
+  }
+
+  if (enc->target) {
+    int branch = e->branch_count++;
+
+    if (branch == vec_len(e->is_near)) {
+      vec_put(e->is_near, false);
+    }
+
+    // start every branch short and only grow the ones relaxation finds out of range
+    if (!e->is_near[branch] && enc->short_opcode != -1) {
+      emit_u8(e, (uint8_t)enc->short_opcode);
+
+      x64_fixup_t fixup = {
+        .at = (int)vec_len(e->code),
+        .size = 1,
+        .branch = branch,
+        .target = enc->target
+      };
+
+      vec_put(e->fixups, fixup);
+      emit_u8(e, 0);
+
+      return;
+    }
+  }
+
+  for (int i = 0; i < enc->opcode_count; ++i) {
+    emit_u8(e, opcode[i]);
+  }
+
+  switch (enc->modrm) {
+    case X64_MODRM_NONE:
+      break;
+
+    case X64_MODRM_REG:
+      emit_u8(e, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+      break;
+
+    case X64_MODRM_MEM: {
+      // stack slots are addressed as [rbp-offset]
+      assert(enc->mem->offset > 0);
+      int32_t disp = -enc->mem->offset;
+      bool disp8 = fits_in_int8(disp);
+
+      emit_u8(e, (disp8 ? 0x40 : 0x80) | ((reg & 7) << 3) | (rm & 7));
+
+      if ((rm & 7) == 4) {
+        emit_u8(e, 0x24);
+      }
+
+      if (disp8) {
+        emit_u8(e, (uint8_t)disp);
+      }
+      else {
+        emit_u32(e, (uint32_t)disp);
+      }
+    } break;
+  }
+
+  switch (imm_kind) {
+    case X64_IMM_NONE:
+      break;
+    case X64_IMM8:
+      emit_u8(e, (uint8_t)enc->imm);
+      break;
+    case X64_IMM32:
+      emit_u32(e, (uint32_t)enc->imm);
+      break;
+    case X64_IMM_SHRINK:
+      assert(false);
+      break;
+  }
+
+  if (enc->target) {
+    x64_fixup_t fixup = {
+      .at = (int)vec_len(e->code),
+      .size = 4,
+      .branch = e->branch_count-1,
+      .target = enc->target
+    };
+
+    vec_put(e->fixups, fixup);
+    emit_u32(e, 0);
+  }
+}
+
 #define R32(r) format_reg32(scratch.arena, r)
 #define R64(r) format_reg64(scratch.arena, r)
 #define ALLOCA(a) format_alloca(scratch.arena, a)
@@ -319,6 +593,7 @@ static machine_block_t* get_branch_else(gen_context_t* g, cb_node_t* node) {
 cb_func_t* cb_select_x64(cb_arena_t* arena, cb_func_t* in_func) {
   scratch_t scratch = scratch_get(1, &arena);
   cb_func_t* new_func = cb_new_func(arena);
+  new_func->register_count = NUM_ALLOCATABLE_PRS;
 
   func_walk_t walk = func_walk_unspecified_order(scratch.arena, in_func);
   
@@ -443,15 +718,23 @@ static void insert_before_n(machine_block_t* mb, machine_inst_t inst, int n) {
   mb->code[i] = inst;
 }
 
-static uint64_t** compute_live_out(arena_t* arena, machine_func_t* func) {
+// a block's live in is revisited only when the live in of one of its successors grows. block ids come
+// from the reverse post-order numbering, so popping them in id order from the back is a post-order walk
+// and most blocks settle the first time they're seen
+
+uint64_t** compute_live_out(arena_t* arena, machine_func_t* func) {
   scratch_t scratch = scratch_get(1, &arena); 
 
-  uint64_t** ue_var   = arena_array(scratch.arena, uint64_t*, func->block_count);
+  uint64_t** live_in  = arena_array(scratch.arena, uint64_t*, func->block_count);
   uint64_t** var_kill = arena_array(scratch.arena, uint64_t*, func->block_count);
   uint64_t** live_out = arena_array(arena, uint64_t*, func->block_count);
 
+  machine_block_t** by_id = arena_array(scratch.arena, machine_block_t*, func->block_count);
+
   foreach_list(machine_block_t, mb, func->block_head) {
-    ue_var[mb->id]   = bitset_alloc(scratch.arena, func->next_reg);
+    by_id[mb->id] = mb;
+
+    live_in[mb->id]  = bitset_alloc(scratch.arena, func->next_reg); // starts out as the upward exposed uses
     var_kill[mb->id] = bitset_alloc(scratch.arena, func->next_reg);
     live_out[mb->id] = bitset_alloc(arena, func->next_reg);
 
@@ -462,7 +745,7 @@ static uint64_t** compute_live_out(arena_t* arena, machine_func_t* func) {
         reg_t y = inst->reads[j];
 
         if (!bitset_get(var_kill[mb->id], y)) {
-          bitset_set(ue_var[mb->id], y);
+          bitset_set(live_in[mb->id], y);
         }
       }
 
@@ -473,28 +756,40 @@ static uint64_t** compute_live_out(arena_t* arena, machine_func_t* func) {
     }
   }
 
-  size_t num_words = bitset_u64_count(func->block_count);
+  int worklist_count = 0;
+  machine_block_t** worklist = arena_array(scratch.arena, machine_block_t*, func->block_count);
+  bool* queued = arena_array(scratch.arena, bool, func->block_count);
 
-  for (;;) {
-    bool changed = false;
+  for (int id = 0; id < func->block_count; ++id) {
+    if (by_id[id]) {
+      worklist[worklist_count++] = by_id[id];
+      queued[id] = true;
+    }
+  }
 
-    foreach_list(machine_block_t, n, func->block_head) {
-      for (int s = 0; s < n->successor_count; ++s) {
-        machine_block_t* m = n->successors[s];
+  uint64_t* through = bitset_alloc(scratch.arena, func->next_reg);
 
-        for (int i = 0; i < num_words; ++i) {
-          uint64_t result = ue_var[m->id][i] | (live_out[m->id][i] & ~(var_kill[m->id][i]));
+  while (worklist_count) {
+    machine_block_t* mb = worklist[--worklist_count];
+    queued[mb->id] = false;
 
-          if ((live_out[n->id][i] | result) != live_out[n->id][i]) {
-            live_out[n->id][i] |= result;
-            changed = true;
-          }
-        }
-      }
+    for (int s = 0; s < mb->successor_count; ++s) {
+      bitset_or(live_out[mb->id], live_in[mb->successors[s]->id], func->next_reg);
     }
 
-    if (!changed) {
-      break;
+    bitset_andnot(through, live_out[mb->id], var_kill[mb->id], func->next_reg);
+
+    if (!bitset_or_changed(live_in[mb->id], through, func->next_reg)) {
+      continue;
+    }
+
+    for (int p = 0; p < mb->predecessor_count; ++p) {
+      machine_block_t* pred = mb->predecessors[p];
+
+      if (!queued[pred->id]) {
+        queued[pred->id] = true;
+        worklist[worklist_count++] = pred;
+      }
     }
   }
 
@@ -540,44 +835,23 @@ static void live_now_clear(live_now_t* live_now) {
   }
 }
 
-static size_t lo_tri_bitset_index(reg_t next_reg) {
-  return (next_reg * (next_reg+1))/2;
-}
-
-static size_t intf_matrix_index(reg_t x, reg_t y) {
-  if (x > y) {
-    reg_t temp = x;
-    x = y;
-    y = temp;
-  }
-
-  return lo_tri_bitset_index(y) + x;
-}
-
-static bool intf_matrix_get(uint64_t* intf_matrix, reg_t x, reg_t y) {
-  return bitset_get(intf_matrix, intf_matrix_index(x, y));
-}
-
-static void intf_matrix_set(uint64_t* intf_matrix, reg_t x, reg_t y) {
-  bitset_set(intf_matrix, intf_matrix_index(x, y));
-}
+// the graph is a sorted adjacency list per register and nothing else, so it stays linear in the edges and
+// membership is a binary search. edges are only ever added in bulk by a walk over the code, which puts the
+// lists it touched back in order once it's done instead of keeping them sorted edge by edge
 
 typedef struct {
-  reg_t next_reg;
-  uint64_t* matrix;
+  arena_t* arena;
+  reg_t next_reg; // registers the graph has seen, a later walk only adds edges for the ones after it
+
   int* spill_cost;
   int* area;
   vec_t(reg_t)* adj;
   vec_t(machine_inst_t*) copies;
 } intf_t;
 
-static intf_t init_intf(arena_t* arena, reg_t next_reg) {
+static intf_t init_intf(arena_t* arena) {
   return (intf_t) {
-    .next_reg = next_reg,
-    .matrix = bitset_alloc(arena, lo_tri_bitset_index(next_reg)),
-    .spill_cost = arena_array(arena, int, next_reg),
-    .area = arena_array(arena, int, next_reg),
-    .adj = arena_array(arena, vec_t(reg_t), next_reg),
+    .arena = arena,
   };
 }
 
@@ -589,8 +863,113 @@ static void free_intf(intf_t* intf) {
   vec_free(intf->copies);
 }
 
+static int compare_regs(const void* a, const void* b) {
+  reg_t x = *(reg_t*)a;
+  reg_t y = *(reg_t*)b;
+  return (x > y) - (x < y);
+}
+
+static void truncate_adj(vec_t(reg_t) adj, int count) {
+  while (count < vec_len(adj)) {
+    vec_pop(adj);
+  }
+}
+
+#define ADJ_INSERTION_SORT_MAX 32
+
+static void sort_adj(vec_t(reg_t) adj) {
+  int len = (int)vec_len(adj);
+
+  if (len > ADJ_INSERTION_SORT_MAX) {
+    qsort(adj, len, sizeof(reg_t), compare_regs);
+  }
+  else {
+    for (int i = 1; i < len; ++i) { // most lists are short enough that qsort's calls cost more than this
+      reg_t x = adj[i];
+      int j = i;
+
+      while (j > 0 && adj[j-1] > x) {
+        adj[j] = adj[j-1];
+        j--;
+      }
+
+      adj[j] = x;
+    }
+  }
+
+  int count = 0;
+
+  for (int i = 0; i < len; ++i) {
+    if (!count || adj[count-1] != adj[i]) {
+      adj[count++] = adj[i];
+    }
+  }
+
+  truncate_adj(adj, count);
+}
+
+static bool adj_contains(vec_t(reg_t) adj, reg_t y) {
+  int lo = 0;
+  int hi = (int)vec_len(adj);
+
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+
+    if (adj[mid] < y) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+
+  return lo < vec_len(adj) && adj[lo] == y;
+}
+
+// physical registers are precolored and never simplified, so nothing reads their lists and they're left empty
+
+static void intf_add_edge(intf_t* intf, bool* touched, reg_t x, reg_t y) {
+  if (x >= FIRST_VR) {
+    vec_put(intf->adj[x], y);
+    touched[x] = true;
+  }
+
+  if (y >= FIRST_VR) {
+    vec_put(intf->adj[y], x);
+    touched[y] = true;
+  }
+}
+
+static bool inst_reads(machine_inst_t* inst, reg_t x) {
+  for (int j = 0; j < inst->num_reads; ++j) {
+    if (inst->reads[j] == x) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// the first walk builds the whole graph. after a spill the only registers it hasn't seen are the spill
+// temporaries, and everything else kept its live range, so later walks just add the edges that touch a new
+// register. costs, areas and copies are recounted every time, the rewrite moved them around
+
 static void build_intf(intf_t* intf, machine_func_t* func) {
-  scratch_t scratch = scratch_get(0, NULL);
+  reg_t first_new = intf->next_reg;
+
+  vec_t(reg_t)* adj = arena_array(intf->arena, vec_t(reg_t), func->next_reg);
+
+  for (reg_t r = 0; r < first_new; ++r) {
+    adj[r] = intf->adj[r];
+  }
+
+  intf->next_reg = func->next_reg;
+  intf->adj = adj;
+  intf->spill_cost = arena_array(intf->arena, int, func->next_reg);
+  intf->area = arena_array(intf->arena, int, func->next_reg);
+  vec_clear(intf->copies);
+
+  scratch_t scratch = scratch_get(1, &intf->arena);
 
   uint64_t** live_out = compute_live_out(scratch.arena, func);
 
@@ -599,17 +978,18 @@ static void build_intf(intf_t* intf, machine_func_t* func) {
     .sparse = arena_array(scratch.arena, int,  func->next_reg),
   };
 
+  live_now_t live_new = { // the part of live_now after first_new
+    .dense = arena_array(scratch.arena, reg_t, func->next_reg),
+    .sparse = arena_array(scratch.arena, int,  func->next_reg),
+  };
+
+  bool* touched = arena_array(scratch.arena, bool, func->next_reg);
+
   for (reg_t r = 0; r < func->next_reg; ++r) {
     live_now.sparse[r] = -1;
-    vec_clear(intf->adj[r]);
+    live_new.sparse[r] = -1;
   }
 
-  vec_clear(intf->copies);
-
-  bitset_clear(intf->matrix, lo_tri_bitset_index(func->next_reg));
-  memset(intf->spill_cost, 0, func->next_reg * sizeof(intf->spill_cost[0]));
-  memset(intf->area, 0, func->next_reg * sizeof(intf->area[0]));
-
   foreach_list(machine_block_t, mb, func->block_head) {
     assert(live_now.count == 0);
 
@@ -619,9 +999,13 @@ static void build_intf(intf_t* intf, machine_func_t* func) {
       exec_factor *= 10;
     }
 
-    for (reg_t r = 0; r < func->next_reg; ++r) {
-      if (bitset_get(live_out[mb->id], r)) {
-        live_now_add(&live_now, r);
+    size_t r;
+
+    for (bitset_iter_t it = bitset_iter(live_out[mb->id], func->next_reg); bitset_next(&it, &r);) {
+      live_now_add(&live_now, (reg_t)r);
+
+      if (r >= first_new) {
+        live_now_add(&live_new, (reg_t)r);
       }
     }
 
@@ -631,17 +1015,18 @@ static void build_intf(intf_t* intf, machine_func_t* func) {
       for (int j = 0; j < inst->num_writes; ++j) {
         reg_t x = inst->writes[j];
 
-        for (int k = 0; k < live_now.count; ++k) {
-          reg_t y = live_now.dense[k];
+        // whatever is live after a two-address write was live before it too, the def that reaches it adds the edges
+        if (inst_reads(inst, x)) {
+          continue;
+        }
 
-          if (x == y) {
-            continue;
-          }
+        live_now_t* others = x >= first_new ? &live_now : &live_new;
+
+        for (int k = 0; k < others->count; ++k) {
+          reg_t y = others->dense[k];
 
-          if (!intf_matrix_get(intf->matrix, x, y)) {
-            intf_matrix_set(intf->matrix, x, y);
-            vec_put(intf->adj[x], y);
-            vec_put(intf->adj[y], x);
+          if (x != y) {
+            intf_add_edge(intf, touched, x, y);
           }
         }
       }
@@ -649,12 +1034,18 @@ static void build_intf(intf_t* intf, machine_func_t* func) {
       for (int j = 0; j < inst->num_writes; ++j) {
         reg_t x = inst->writes[j];
         live_now_remove(&live_now, x);
+        live_now_remove(&live_new, x);
         intf->spill_cost[x] += exec_factor;
       }
 
       for (int j = 0; j < inst->num_reads; ++j) {
         reg_t x = inst->reads[j];
         live_now_add(&live_now, x);
+
+        if (x >= first_new) {
+          live_now_add(&live_new, x);
+        }
+
         intf->spill_cost[x] += exec_factor;
       }
 
@@ -669,7 +1060,26 @@ static void build_intf(intf_t* intf, machine_func_t* func) {
     }
 
     live_now_clear(&live_now);
+    live_now_clear(&live_new);
+  }
+
+  for (reg_t r = 0; r < func->next_reg; ++r) {
+    if (touched[r]) {
+      sort_adj(intf->adj[r]);
+    }
   }
+
+  scratch_release(&scratch);
+}
+
+void x64_build_intf(machine_func_t* func) {
+  scratch_t scratch = scratch_get(0, NULL);
+
+  intf_t intf = init_intf(scratch.arena);
+  build_intf(&intf, func);
+  free_intf(&intf);
+
+  scratch_release(&scratch);
 }
 
 static reg_t get_coalesced(reg_t* coalesced_map, reg_t x) {
@@ -707,49 +1117,118 @@ static void add_to_select_stack(int index, intf_t* intf, int* degree, reg_t* sim
   }
 }
 
-static void regalloc_try_color(arena_t* arena, machine_func_t* func) { 
+// coalescing merges adjacency lists without renaming what's in them, so a survivor's list holds every
+// register any member of its group interfered with. two groups interfere if one's list has a member of the other
+
+static bool groups_interfere(intf_t* intf, reg_t* next_member, int* member_count, reg_t x, reg_t y) {
+  if (member_count[x] > member_count[y]) {
+    reg_t temp = x;
+    x = y;
+    y = temp;
+  }
+
+  reg_t m = x;
+
+  do {
+    if (adj_contains(intf->adj[y], m)) {
+      return true;
+    }
+
+    m = next_member[m];
+  } while (m != x);
+
+  return false;
+}
+
+static void merge_adj(intf_t* intf, reg_t src, reg_t dest) {
+  vec_t(reg_t) a = intf->adj[src];
+  vec_t(reg_t) b = intf->adj[dest];
+
+  int i = (int)vec_len(a) - 1;
+  int j = (int)vec_len(b) - 1;
+
+  for (int k = 0; k <= j; ++k) {
+    vec_put(a, 0);
+  }
+
+  // merging from the back fills the room made for b without overwriting anything still unread
+
+  for (int k = (int)vec_len(a) - 1; j >= 0; --k) {
+    if (i >= 0 && a[i] > b[j]) {
+      a[k] = a[i--];
+    }
+    else {
+      a[k] = b[j--];
+    }
+  }
+
+  int count = 0;
+
+  for (int k = 0; k < vec_len(a); ++k) {
+    if (!count || a[count-1] != a[k]) {
+      a[count++] = a[k];
+    }
+  }
+
+  truncate_adj(a, count);
+  vec_free(b);
+
+  intf->adj[src] = a;
+  intf->adj[dest] = NULL;
+}
+
+static void try_color(arena_t* arena, machine_func_t* func, intf_t* intf) {
+  stats_begin_phase(STAT_PHASE_BUILD_INTF);
+  build_intf(intf, func);
+  stats_end_phase(STAT_PHASE_BUILD_INTF);
+
   scratch_t scratch = scratch_get(1, &arena);
 
-  intf_t intf = init_intf(scratch.arena, func->next_reg);
   reg_t* coalesce_map = arena_array(scratch.arena, reg_t, func->next_reg);
+  reg_t* next_member = arena_array(scratch.arena, reg_t, func->next_reg); // circular list through a group
+  int* member_count = arena_array(scratch.arena, int, func->next_reg);
 
   for (reg_t r = 0; r < func->next_reg; ++r) {
     coalesce_map[r] = r;
+    next_member[r] = r;
+    member_count[r] = 1;
   }
 
-  for (;;) {
-    build_intf(&intf, func);
+  // a coalesced register interferes with whatever either half did, so the survivor takes on the
+  // other's edges and the graph stays exact without being rebuilt. adjacency lists hold stale
+  // registers until they're compacted below
 
-    bool any_coalesced = false;
+  bool any_coalesced = false;
 
-    for (int i = 0; i < vec_len(intf.copies); ++i) {
-      machine_inst_t* copy = intf.copies[i];
+  for (int i = 0; i < vec_len(intf->copies); ++i) {
+    machine_inst_t* copy = intf->copies[i];
 
-      reg_t dest = get_coalesced(coalesce_map, copy->writes[0]);
-      reg_t src = get_coalesced(coalesce_map, copy->reads[0]);
+    reg_t dest = get_coalesced(coalesce_map, copy->writes[0]);
+    reg_t src = get_coalesced(coalesce_map, copy->reads[0]);
 
-      if (dest == src || dest < FIRST_VR || src < FIRST_VR) {
-        continue;
-      }
+    if (dest == src || dest < FIRST_VR || src < FIRST_VR) {
+      continue;
+    }
 
-      if (!intf_matrix_get(intf.matrix, dest, src)) {
-        coalesce_map[dest] = src;
+    if (!groups_interfere(intf, next_member, member_count, dest, src)) {
+      coalesce_map[dest] = src;
+      stats_count(STAT_COALESCES, 1);
 
-        for (int j = 0; j < vec_len(intf.adj[dest]); ++j) {
-          reg_t y = intf.adj[dest][j];
-          intf_matrix_set(intf.matrix, src, y);
-          vec_put(intf.adj[src], y);
-          vec_put(intf.adj[y], src);
-        }
+      merge_adj(intf, src, dest);
 
-        any_coalesced = true;
-      }
-    }
+      reg_t temp = next_member[src];
+      next_member[src] = next_member[dest];
+      next_member[dest] = temp;
+      member_count[src] += member_count[dest];
 
-    if (!any_coalesced) {
-      break;
+      intf->spill_cost[src] += intf->spill_cost[dest];
+      intf->area[src] += intf->area[dest];
+
+      any_coalesced = true;
     }
+  }
 
+  if (any_coalesced) {
     // rewrite code to use coalesced registers
 
     foreach_list(machine_block_t, mb, func->block_head) {
@@ -784,6 +1263,28 @@ static void regalloc_try_color(arena_t* arena, machine_func_t* func) {
         vec_pop(mb->code);
       }
     }
+
+    // rename the adjacency lists to the survivors, which can reorder and duplicate them
+
+    for (reg_t r = 0; r < func->next_reg; ++r) {
+      if (!intf->adj[r]) {
+        continue;
+      }
+
+      int count = 0;
+
+      for (int j = 0; j < vec_len(intf->adj[r]); ++j) {
+        reg_t y = get_coalesced(coalesce_map, intf->adj[r][j]);
+
+        if (y != r) {
+          intf->adj[r][count++] = y;
+        }
+      }
+
+      truncate_adj(intf->adj[r], count);
+
+      sort_adj(intf->adj[r]);
+    }
   }
 
   int* degree = arena_array(scratch.arena, int, func->next_reg);
@@ -796,7 +1297,7 @@ static void regalloc_try_color(arena_t* arena, machine_func_t* func) {
       simplify_left[simplify_left_count++] = r;
     }
 
-    degree[r] = (int)vec_len(intf.adj[r]);
+    degree[r] = (int)vec_len(intf->adj[r]);
   }
 
   int stack_count = 0;
@@ -807,7 +1308,7 @@ static void regalloc_try_color(arena_t* arena, machine_func_t* func) {
       reg_t x = simplify_left[i];
 
       if (degree[x] < NUM_ALLOCATABLE_PRS) {
-        add_to_select_stack(i, &intf, degree, simplify_left, &simplify_left_count, stack, &stack_count);
+        add_to_select_stack(i, intf, degree, simplify_left, &simplify_left_count, stack, &stack_count);
       }
     }
 
@@ -822,15 +1323,15 @@ static void regalloc_try_color(arena_t* arena, machine_func_t* func) {
     for (int i = 0; i < simplify_left_count; ++i) {
       reg_t x = simplify_left[i];
 
-      float cost = (float)intf.spill_cost[x]/((float)degree[x]*(float)intf.area[x]);
+      float cost = (float)intf->spill_cost[x]/((float)degree[x]*(float)intf->area[x]);
 
-      if (cost < best_cost) {
+      if (best_index == NULL_REG || cost < best_cost) { // every cost can be infinite when the areas are empty
         best_cost = cost;
         best_index = i;
       }
     }
 
-    add_to_select_stack(best_index, &intf, degree, simplify_left, &simplify_left_count, stack, &stack_count);
+    add_to_select_stack(best_index, intf, degree, simplify_left, &simplify_left_count, stack, &stack_count);
   }
 
   reg_t* map = arena_array(scratch.arena, reg_t, func->next_reg);
@@ -858,8 +1359,8 @@ static void regalloc_try_color(arena_t* arena, machine_func_t* func) {
 
     bitset_clear(taken, NUM_ALLOCATABLE_PRS);
 
-    for (int i = 0; i < vec_len(intf.adj[x]); ++i) {
-      reg_t y = intf.adj[x][i];
+    for (int i = 0; i < vec_len(intf->adj[x]); ++i) {
+      reg_t y = intf->adj[x][i];
 
       if(map[y] != NULL_REG) {
         bitset_set(taken, map[y]);
@@ -876,6 +1377,7 @@ static void regalloc_try_color(arena_t* arena, machine_func_t* func) {
       spill_loc[x] = new_alloca(arena, func);
       bitset_set(spill_set, x);
       any_spill = true;
+      stats_count(STAT_SPILLS, 1);
     }
   }
 
@@ -886,6 +1388,13 @@ static void regalloc_try_color(arena_t* arena, machine_func_t* func) {
       for (int i = 0; i < vec_len(mb->code); ++i) {
         machine_inst_t* inst = mb->code + i;
 
+        // two-address instructions read and write the same register, so a spilled
+        // register gets one temporary per instruction however many times it appears
+
+        int temp_count = 0;
+        reg_t spilled[INST_MAX_READS + INST_MAX_WRITES];
+        reg_t temps[INST_MAX_READS + INST_MAX_WRITES];
+
         for (int j = 0; j < inst->num_reads; ++j) {
           reg_t x = inst->reads[j];
 
@@ -893,8 +1402,18 @@ static void regalloc_try_color(arena_t* arena, machine_func_t* func) {
             continue;
           }
 
-          reg_t y = inst->reads[j] = func->next_reg++;
-          vec_put(new_code, inst_mov32_rm(arena, y, spill_loc[x]));
+          int k = 0;
+          while (k < temp_count && spilled[k] != x) {
+            k++;
+          }
+
+          if (k == temp_count) {
+            spilled[temp_count] = x;
+            temps[temp_count++] = func->next_reg++;
+            vec_put(new_code, inst_mov32_rm(arena, temps[k], spill_loc[x]));
+          }
+
+          inst->reads[j] = temps[k];
         }
 
         int new_inst = (int)vec_len(new_code);
@@ -907,14 +1426,55 @@ static void regalloc_try_color(arena_t* arena, machine_func_t* func) {
             continue;
           }
 
-          reg_t y = new_code[new_inst].writes[j] = func->next_reg++;
-          vec_put(new_code, inst_mov32_mr(arena, y, spill_loc[x]));
-        }
-      }
+          int k = 0;
+          while (k < temp_count && spilled[k] != x) {
+            k++;
+          }
+
+          if (k == temp_count) {
+            spilled[temp_count] = x;
+            temps[temp_count++] = func->next_reg++;
+          }
+
+          new_code[new_inst].writes[j] = temps[k];
+          vec_put(new_code, inst_mov32_mr(arena, temps[k], spill_loc[x]));
+        }
+      }
 
       vec_free(mb->code);
       mb->code = new_code;
     }
+
+    // the spilled registers are gone from the code, so they leave the graph. only their neighbours'
+    // lists change, everything else carries over to the next round as it is
+
+    bool* touched = arena_array(scratch.arena, bool, intf->next_reg);
+    size_t x;
+
+    for (bitset_iter_t it = bitset_iter(spill_set, intf->next_reg); bitset_next(&it, &x);) {
+      for (int j = 0; j < vec_len(intf->adj[x]); ++j) {
+        touched[intf->adj[x][j]] = true;
+      }
+
+      vec_free(intf->adj[x]);
+      intf->adj[x] = NULL;
+    }
+
+    for (reg_t r = 0; r < intf->next_reg; ++r) {
+      if (!touched[r]) {
+        continue;
+      }
+
+      int count = 0;
+
+      for (int j = 0; j < vec_len(intf->adj[r]); ++j) {
+        if (!bitset_get(spill_set, intf->adj[r][j])) {
+          intf->adj[r][count++] = intf->adj[r][j];
+        }
+      }
+
+      truncate_adj(intf->adj[r], count);
+    }
   }
   else {
     foreach_list(machine_block_t, mb, func->block_head) {
@@ -932,74 +1492,658 @@ static void regalloc_try_color(arena_t* arena, machine_func_t* func) {
     }
   }
 
+  scratch_release(&scratch);
+}
+
+void regalloc_try_color(arena_t* arena, machine_func_t* func) {
+  scratch_t scratch = scratch_get(1, &arena);
+
+  intf_t intf = init_intf(scratch.arena);
+  try_color(arena, func, &intf);
   free_intf(&intf);
+
   scratch_release(&scratch);
 }
 
-static void regalloc(arena_t* arena, machine_func_t* func) { 
-  int iterations = 0;
+// linear scan numbers the instructions in layout order, reads at an even position and writes at the
+// odd one after it, and gives each virtual register one interval covering everywhere it's live.
+// physical registers keep their exact ranges so eax and edx are only handed out between fixed uses
 
-  reg_t prev = func->next_reg;
+#define NUM_LINEAR_SCAN_SCRATCH 2
 
-  while (iterations++ < 10) {
-    regalloc_try_color(arena, func);
+static reg_t linear_scan_scratch[NUM_LINEAR_SCAN_SCRATCH] = { PR_R10D, PR_R11D }; // spilled operands are loaded into these, never allocated
 
-    if (func->next_reg == prev) {
-      break;
+typedef struct {
+  int start;
+  int end;
+} live_range_t;
+
+typedef struct {
+  int position_count;
+
+  int* start; // -1 if the register never appears
+  int* end;
+  reg_t* first_at; // registers whose interval starts at each position, chained through next_at
+  reg_t* next_at;
+
+  vec_t(live_range_t) fixed[NUM_ALLOCATABLE_PRS];
+  int fixed_cursor[NUM_ALLOCATABLE_PRS];
+} live_intervals_t;
+
+static void add_live_range(live_intervals_t* li, reg_t r, int start, int end) {
+  if (r >= FIRST_VR) {
+    if (li->start[r] == -1 || start < li->start[r]) {
+      li->start[r] = start;
+    }
+
+    if (end > li->end[r]) {
+      li->end[r] = end;
+    }
+  }
+  else if (r < NUM_ALLOCATABLE_PRS) {
+    live_range_t range = { start, end };
+    vec_put(li->fixed[r], range);
+  }
+}
+
+static int compare_live_ranges(const void* a, const void* b) {
+  return ((live_range_t*)a)->start - ((live_range_t*)b)->start;
+}
+
+static live_intervals_t build_live_intervals(arena_t* arena, machine_func_t* func) {
+  scratch_t scratch = scratch_get(1, &arena);
+
+  uint64_t** live_out = compute_live_out(scratch.arena, func);
+
+  live_now_t live_now = {
+    .dense = arena_array(scratch.arena, reg_t, func->next_reg),
+    .sparse = arena_array(scratch.arena, int, func->next_reg),
+  };
+
+  int* live_end = arena_array(scratch.arena, int, func->next_reg);
+
+  live_intervals_t li = {
+    .start = arena_array(arena, int, func->next_reg),
+    .end = arena_array(arena, int, func->next_reg),
+    .next_at = arena_array(arena, reg_t, func->next_reg),
+  };
+
+  for (reg_t r = 0; r < func->next_reg; ++r) {
+    live_now.sparse[r] = -1;
+    li.start[r] = -1;
+    li.end[r] = -1;
+  }
+
+  foreach_list(machine_block_t, mb, func->block_head) {
+    int from = li.position_count;
+    int to = from + 2 * (int)vec_len(mb->code); // one past the last write, so a live out value outlasts the block
+
+    li.position_count = to + 2;
+
+    size_t r;
+
+    for (bitset_iter_t it = bitset_iter(live_out[mb->id], func->next_reg); bitset_next(&it, &r);) {
+      live_now_add(&live_now, (reg_t)r);
+      live_end[r] = to;
+    }
+
+    for (int i = (int)vec_len(mb->code)-1; i >= 0; --i) {
+      machine_inst_t* inst = mb->code + i;
+      int pos = from + 2 * i;
+
+      for (int j = 0; j < inst->num_writes; ++j) {
+        reg_t x = inst->writes[j];
+
+        if (live_now.sparse[x] != -1) {
+          add_live_range(&li, x, pos + 1, live_end[x]);
+          live_now_remove(&live_now, x);
+        }
+        else {
+          add_live_range(&li, x, pos + 1, pos + 1); // dead definitions still need somewhere to go
+        }
+      }
+
+      for (int j = 0; j < inst->num_reads; ++j) {
+        reg_t x = inst->reads[j];
+
+        if (live_now.sparse[x] == -1) {
+          live_now_add(&live_now, x);
+          live_end[x] = pos;
+        }
+      }
+    }
+
+    for (int i = 0; i < live_now.count; ++i) {
+      reg_t r = live_now.dense[i];
+      add_live_range(&li, r, from, live_end[r]);
+    }
+
+    live_now_clear(&live_now);
+  }
+
+  li.first_at = arena_array(arena, reg_t, li.position_count);
+
+  for (int i = 0; i < li.position_count; ++i) {
+    li.first_at[i] = NULL_REG;
+  }
+
+  for (reg_t r = func->next_reg-1; r >= FIRST_VR; --r) {
+    if (li.start[r] != -1) {
+      li.next_at[r] = li.first_at[li.start[r]];
+      li.first_at[li.start[r]] = r;
+    }
+  }
+
+  for (reg_t pr = 0; pr < NUM_ALLOCATABLE_PRS; ++pr) {
+    qsort(li.fixed[pr], vec_len(li.fixed[pr]), sizeof(live_range_t), compare_live_ranges);
+  }
+
+  scratch_release(&scratch);
+
+  return li;
+}
+
+static void free_live_intervals(live_intervals_t* li) {
+  for (reg_t pr = 0; pr < NUM_ALLOCATABLE_PRS; ++pr) {
+    vec_free(li->fixed[pr]);
+  }
+}
+
+static bool overlaps_fixed(live_intervals_t* li, reg_t pr, int start, int end) {
+  // intervals are allocated in order of their start, so ranges that ended before this one are done with
+  while (li->fixed_cursor[pr] < vec_len(li->fixed[pr]) && li->fixed[pr][li->fixed_cursor[pr]].end < start) {
+    li->fixed_cursor[pr]++;
+  }
+
+  return li->fixed_cursor[pr] < vec_len(li->fixed[pr]) && li->fixed[pr][li->fixed_cursor[pr]].start <= end;
+}
+
+static bool is_linear_scan_scratch(reg_t pr) {
+  for (int i = 0; i < NUM_LINEAR_SCAN_SCRATCH; ++i) {
+    if (linear_scan_scratch[i] == pr) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void rewrite_linear_scan(arena_t* arena, machine_func_t* func, reg_t* map, alloca_t** spill_loc) {
+  foreach_list(machine_block_t, mb, func->block_head) {
+    vec_t(machine_inst_t) new_code = NULL;
+
+    for (int i = 0; i < vec_len(mb->code); ++i) {
+      machine_inst_t* inst = mb->code + i;
+
+      if (inst->op == X64_INST_MOV32_RR) {
+        reg_t dest = inst->writes[0];
+        reg_t src = inst->reads[0];
+
+        if (spill_loc[dest] && !spill_loc[src]) {
+          vec_put(new_code, inst_mov32_mr(arena, map[src], spill_loc[dest]));
+          continue;
+        }
+
+        if (spill_loc[src] && !spill_loc[dest]) {
+          vec_put(new_code, inst_mov32_rm(arena, map[dest], spill_loc[src]));
+          continue;
+        }
+
+        if (!spill_loc[src] && map[dest] == map[src]) {
+          continue;
+        }
+      }
+
+      if (inst->op == X64_INST_MOV32_RI && spill_loc[inst->writes[0]]) {
+        vec_put(new_code, inst_mov32_mi(arena, spill_loc[inst->writes[0]], (uint32_t)inst->data));
+        continue;
+      }
+
+      // same as the colorer's spill code, except the temporaries are the reserved scratch registers
+
+      int temp_count = 0;
+      reg_t spilled[NUM_LINEAR_SCAN_SCRATCH];
+
+      for (int j = 0; j < inst->num_reads; ++j) {
+        reg_t x = inst->reads[j];
+
+        if (!spill_loc[x]) {
+          inst->reads[j] = map[x];
+          continue;
+        }
+
+        int k = 0;
+        while (k < temp_count && spilled[k] != x) {
+          k++;
+        }
+
+        if (k == temp_count) {
+          assert(temp_count < NUM_LINEAR_SCAN_SCRATCH);
+          spilled[temp_count++] = x;
+          vec_put(new_code, inst_mov32_rm(arena, linear_scan_scratch[k], spill_loc[x]));
+        }
+
+        inst->reads[j] = linear_scan_scratch[k];
+      }
+
+      int new_inst = (int)vec_len(new_code);
+      vec_put(new_code, *inst);
+
+      for (int j = 0; j < inst->num_writes; ++j) {
+        reg_t x = new_code[new_inst].writes[j];
+
+        if (!spill_loc[x]) {
+          new_code[new_inst].writes[j] = map[x];
+          continue;
+        }
+
+        int k = 0;
+        while (k < temp_count && spilled[k] != x) {
+          k++;
+        }
+
+        if (k == temp_count) {
+          assert(temp_count < NUM_LINEAR_SCAN_SCRATCH);
+          spilled[temp_count++] = x;
+        }
+
+        new_code[new_inst].writes[j] = linear_scan_scratch[k];
+        vec_put(new_code, inst_mov32_mr(arena, linear_scan_scratch[k], spill_loc[x]));
+      }
+    }
+
+    vec_free(mb->code);
+    mb->code = new_code;
+  }
+}
+
+void regalloc_linear_scan(arena_t* arena, machine_func_t* func) {
+  scratch_t scratch = scratch_get(1, &arena);
+
+  live_intervals_t li = build_live_intervals(scratch.arena, func);
+
+  reg_t* map = arena_array(scratch.arena, reg_t, func->next_reg);
+  reg_t* hint = arena_array(scratch.arena, reg_t, func->next_reg);
+  alloca_t** spill_loc = arena_array(scratch.arena, alloca_t*, func->next_reg);
+
+  for (reg_t r = 0; r < func->next_reg; ++r) {
+    map[r] = r < FIRST_VR ? r : NULL_REG;
+    hint[r] = NULL_REG;
+  }
+
+  // a copy's two sides share a register when their intervals only meet at the copy
+
+  foreach_list(machine_block_t, mb, func->block_head) {
+    for (int i = 0; i < vec_len(mb->code); ++i) {
+      machine_inst_t* inst = mb->code + i;
+
+      if (inst->op == X64_INST_MOV32_RR) {
+        hint[inst->writes[0]] = inst->reads[0];
+        hint[inst->reads[0]] = inst->writes[0];
+      }
     }
+  }
 
-    prev = func->next_reg;
+  reg_t active[NUM_ALLOCATABLE_PRS];
+
+  for (reg_t pr = 0; pr < NUM_ALLOCATABLE_PRS; ++pr) {
+    active[pr] = NULL_REG;
   }
 
-  if (iterations == 10) {
-    printf("compiler bug: register allocation failed!\n");
-    exit(1);
+  for (int pos = 0; pos < li.position_count; ++pos) {
+    for (reg_t x = li.first_at[pos]; x != NULL_REG; x = li.next_at[x]) {
+      int start = li.start[x];
+      int end = li.end[x];
+
+      for (reg_t pr = 0; pr < NUM_ALLOCATABLE_PRS; ++pr) {
+        if (active[pr] != NULL_REG && li.end[active[pr]] < start) {
+          active[pr] = NULL_REG;
+        }
+      }
+
+      reg_t choice = NULL_REG;
+      reg_t hinted = hint[x] == NULL_REG ? NULL_REG : map[hint[x]];
+
+      if (hinted < NUM_ALLOCATABLE_PRS && !is_linear_scan_scratch(hinted) && active[hinted] == NULL_REG && !overlaps_fixed(&li, hinted, start, end)) {
+        choice = hinted;
+      }
+
+      for (reg_t pr = 0; choice == NULL_REG && pr < NUM_ALLOCATABLE_PRS; ++pr) {
+        if (!is_linear_scan_scratch(pr) && active[pr] == NULL_REG && !overlaps_fixed(&li, pr, start, end)) {
+          choice = pr;
+        }
+      }
+
+      if (choice == NULL_REG) {
+        // spill whichever interval reaches furthest, which may be this one
+
+        int furthest = end;
+
+        for (reg_t pr = 0; pr < NUM_ALLOCATABLE_PRS; ++pr) {
+          if (active[pr] != NULL_REG && li.end[active[pr]] > furthest && !overlaps_fixed(&li, pr, start, end)) {
+            furthest = li.end[active[pr]];
+            choice = pr;
+          }
+        }
+
+        reg_t victim = choice == NULL_REG ? x : active[choice];
+
+        map[victim] = NULL_REG;
+        spill_loc[victim] = new_alloca(arena, func);
+        stats_count(STAT_SPILLS, 1);
+      }
+
+      if (choice != NULL_REG) {
+        map[x] = choice;
+        active[choice] = x;
+      }
+    }
+  }
+
+  rewrite_linear_scan(arena, func, map, spill_loc);
+
+  free_live_intervals(&li);
+  scratch_release(&scratch);
+}
+
+static void regalloc(arena_t* arena, machine_func_t* func, cb_regalloc_t kind) { 
+  stats_begin_phase(STAT_PHASE_REGALLOC);
+  trace_begin("regalloc", NULL);
+
+  if (kind == CB_REGALLOC_LINEAR_SCAN) {
+    regalloc_linear_scan(arena, func);
+  }
+  else {
+    scratch_t scratch = scratch_get(1, &arena);
+
+    intf_t intf = init_intf(scratch.arena); // kept across rounds, each one only adds the spill temporaries
+
+    int iterations = 0;
+
+    reg_t prev = func->next_reg;
+
+    while (iterations++ < 10) {
+      try_color(arena, func, &intf);
+      stats_count(STAT_REGALLOC_ITERATIONS, 1);
+
+      if (func->next_reg == prev) {
+        break;
+      }
+
+      prev = func->next_reg;
+    }
+
+    free_intf(&intf);
+    scratch_release(&scratch);
+
+    if (iterations == 10) {
+      printf("compiler bug: register allocation failed!\n");
+      exit(1);
+    }
   }
+
+  trace_end();
+  stats_end_phase(STAT_PHASE_REGALLOC);
 }
 
-static void dump_func(machine_func_t* func) {
+static void dump_func(FILE* stream, machine_func_t* func) {
+  if (!stream) {
+    return;
+  }
+
   foreach_list(machine_block_t, mb, func->block_head) {
-    printf("bb_%d:\n", mb->id);
+    fprintf(stream, "bb_%d:\n", mb->id);
 
     for (int i = 0; i < vec_len(mb->code); ++i) {
       machine_inst_t* inst = mb->code + i; 
 
-      printf("  ");
-      print_inst(stdout, inst);
-      printf("\n");
+      fprintf(stream, "  ");
+      print_inst(stream, inst);
+      fprintf(stream, "\n");
     }
   }
 
-  printf("\n");
+  fprintf(stream, "\n");
 }
 
-void cb_generate_x64(cb_func_t* func) {
-  scratch_t scratch = scratch_get(0, NULL);  
+#define MAX_ROTATED_HEADER_INSTS 16
 
-  machine_func_t machine_func = {
-    .next_reg = FIRST_VR
-  };
+static void add_predecessor(arena_t* arena, machine_block_t* mb, machine_block_t* pred) {
+  machine_block_t** predecessors = arena_array(arena, machine_block_t*, mb->predecessor_count + 1);
+  memcpy(predecessors, mb->predecessors, mb->predecessor_count * sizeof(machine_block_t*));
+  predecessors[mb->predecessor_count++] = pred;
+  mb->predecessors = predecessors;
+}
+
+static void remove_predecessor(machine_block_t* mb, machine_block_t* pred) {
+  for (int i = 0; i < mb->predecessor_count; ++i) {
+    if (mb->predecessors[i] == pred) {
+      mb->predecessors[i] = mb->predecessors[--mb->predecessor_count];
+      return;
+    }
+  }
+
+  assert(false);
+}
+
+// turns while loops into guarded do-whiles. the header is left in front of the loop as the guard and
+// every latch gets its own copy of the header, so the back edge is a conditional branch straight to the body
+static void rotate_loops(arena_t* arena, cb_gcm_result_t* gcm, machine_block_t** block_map) {
+  for (int i = 0; i < gcm->loop_count; ++i) {
+    cb_loop_t* loop = gcm->loops[i];
+    machine_block_t* header = block_map[loop->header->id];
+
+    if (loop->is_irreducible || header->successor_count != 2 || vec_len(header->code) > MAX_ROTATED_HEADER_INSTS) {
+      continue;
+    }
+
+    bool then_inside = loop_contains(loop, header->successors[0]->b);
+    bool else_inside = loop_contains(loop, header->successors[1]->b);
+
+    if (then_inside == else_inside) { // no exit test to rotate
+      continue;
+    }
+
+    machine_block_t* body = header->successors[then_inside ? 0 : 1];
+    machine_block_t* exit = header->successors[then_inside ? 1 : 0];
+
+    int copy_count = (int)vec_len(header->code) - header->terminator_count;
+    assert(header->code[copy_count].op == X64_INST_JZ && (machine_block_t*)header->code[copy_count].data == header->successors[1]);
+
+    for (int p = 0; p < header->predecessor_count;) {
+      machine_block_t* latch = header->predecessors[p];
+
+      if (latch->successor_count != 1 || !loop_contains(loop, latch->b)) {
+        p++;
+        continue;
+      }
+
+      machine_inst_t jmp = vec_pop(latch->code);
+      assert(latch->terminator_count == 1 && jmp.op == X64_INST_JMP);
+      (void)jmp;
+
+      for (int j = 0; j < copy_count; ++j) {
+        vec_put(latch->code, header->code[j]);
+      }
+
+      // branch back to the body on whichever condition keeps the loop going
+
+      if (then_inside) {
+        vec_put(latch->code, inst_jnz(arena, body));
+      }
+      else {
+        vec_put(latch->code, inst_jz(arena, body));
+      }
+
+      vec_put(latch->code, inst_jmp(arena, exit));
+
+      latch->terminator_count = 2;
+      latch->successor_count = 2;
+      latch->successors[0] = header->successors[0];
+      latch->successors[1] = header->successors[1];
+
+      remove_predecessor(header, latch); // swaps another predecessor into slot p
+      add_predecessor(arena, body, latch);
+      add_predecessor(arena, exit, latch);
+    }
+  }
+}
+
+// static guess standing in for a profile: leaving a loop is unlikely and entering one is likely
+static int edge_weight(machine_block_t* from, machine_block_t* to) {
+  if (from->b->loop && !loop_contains(from->b->loop, to->b)) {
+    return -1;
+  }
+
+  return to->loop_nesting;
+}
+
+static bool leaves_unfinished_loop(int* unplaced, machine_block_t* from, machine_block_t* to) {
+  for (cb_loop_t* loop = from->b->loop; loop && !loop_contains(loop, to->b); loop = loop->parent) {
+    if (unplaced[loop->id]) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// a join waits until every block that reaches it along a forward edge has been placed,
+// otherwise the arm placed last has to jump back to it. block ids are reverse post-order
+static bool has_unplaced_forward_predecessor(bool* placed, machine_block_t* mb) {
+  for (int i = 0; i < mb->predecessor_count; ++i) {
+    machine_block_t* pred = mb->predecessors[i];
+
+    if (pred->id < mb->id && !placed[pred->id]) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// chains blocks so each falls through to its likelier successor, and only leaves a loop once
+// all of its blocks are placed. the chain restarts from the earliest free block of the innermost unfinished loop
+static void place_blocks(arena_t* arena, machine_func_t* func, cb_gcm_result_t* gcm) {
+  scratch_t scratch = scratch_get(1, &arena);
+
+  machine_block_t** order = arena_array(scratch.arena, machine_block_t*, func->block_count);
+  bool* placed = arena_array(scratch.arena, bool, func->block_count);
+  int* unplaced = arena_array(scratch.arena, int, gcm->loop_count); // per loop, blocks still to place
+
+  int order_count = 0;
+
+  foreach_list(machine_block_t, mb, func->block_head) {
+    order[order_count++] = mb;
+
+    for (cb_loop_t* loop = mb->b->loop; loop; loop = loop->parent) {
+      unplaced[loop->id]++;
+    }
+  }
+
+  // every loop's blocks in order, with a cursor that only ever moves past placed ones. placed blocks
+  // stay placed, so the earliest free block of a loop never moves backwards
+
+  machine_block_t*** loop_blocks = arena_array(scratch.arena, machine_block_t**, gcm->loop_count);
+  int* loop_cursor = arena_array(scratch.arena, int, gcm->loop_count);
+
+  for (int i = 0; i < gcm->loop_count; ++i) {
+    loop_blocks[i] = arena_array(scratch.arena, machine_block_t*, unplaced[i]);
+  }
+
+  for (int i = 0; i < order_count; ++i) {
+    for (cb_loop_t* loop = order[i]->b->loop; loop; loop = loop->parent) {
+      loop_blocks[loop->id][loop_cursor[loop->id]++] = order[i];
+    }
+  }
+
+  for (int i = 0; i < gcm->loop_count; ++i) {
+    loop_cursor[i] = 0;
+  }
+
+  machine_block_t head = {0};
+  machine_block_t* tail = &head;
+
+  int cursor = 0;
+
+  for (machine_block_t* mb = order[0]; mb;) {
+    tail = tail->next = mb;
+    placed[mb->id] = true;
+
+    for (cb_loop_t* loop = mb->b->loop; loop; loop = loop->parent) {
+      unplaced[loop->id]--;
+    }
+
+    machine_block_t* next = NULL;
+
+    for (int i = 0; i < mb->successor_count; ++i) {
+      machine_block_t* succ = mb->successors[i];
+
+      if (placed[succ->id] || leaves_unfinished_loop(unplaced, mb, succ) || has_unplaced_forward_predecessor(placed, succ)) {
+        continue;
+      }
+
+      if (!next || edge_weight(mb, succ) > edge_weight(mb, next)) {
+        next = succ;
+      }
+    }
+
+    for (cb_loop_t* loop = mb->b->loop; loop && !next; loop = loop->parent) {
+      if (!unplaced[loop->id]) {
+        continue;
+      }
 
-  cb_gcm_result_t gcm = cb_run_global_code_motion(scratch.arena, func);
+      machine_block_t** blocks = loop_blocks[loop->id];
+      int* loop_next = loop_cursor + loop->id;
 
-  machine_block_t** block_map = arena_array(scratch.arena, machine_block_t*, gcm.block_count);
-  reg_t* reg_map = arena_array(scratch.arena, reg_t, func->next_id);
-  alloca_t** alloca_map = arena_array(scratch.arena, alloca_t*, func->next_id);
+      while (placed[blocks[*loop_next]->id]) { // one is still unplaced, so this stops inside the loop
+        (*loop_next)++;
+      }
+
+      next = blocks[*loop_next];
+    }
+
+    while (!next && cursor < order_count) {
+      if (!placed[order[cursor]->id]) {
+        next = order[cursor];
+      }
+
+      cursor++;
+    }
+
+    mb = next;
+  }
+
+  tail->next = NULL;
+  func->block_head = head.next;
+
+  scratch_release(&scratch);
+}
+
+machine_func_t* x64_build_machine_func(arena_t* arena, cb_func_t* func) {
+  machine_func_t* machine_func = arena_type(arena, machine_func_t);
+  machine_func->next_reg = FIRST_VR;
+
+  cb_gcm_result_t gcm = cb_run_global_code_motion(func);
+
+  machine_block_t** block_map = arena_array(arena, machine_block_t*, gcm.block_count);
+  reg_t* reg_map = arena_array(arena, reg_t, func->next_id);
+  alloca_t** alloca_map = arena_array(arena, alloca_t*, func->next_id);
 
   {
     machine_block_t block_head = {0};
     machine_block_t* block_tail = &block_head;
 
     foreach_list(cb_block_t, b, gcm.cfg) {
-      machine_block_t* mb = block_tail = block_tail->next = arena_type(scratch.arena, machine_block_t);
+      machine_block_t* mb = block_tail = block_tail->next = arena_type(arena, machine_block_t);
       mb->b = b;
       mb->id = b->id;
       mb->loop_nesting = b->loop_nesting;
       block_map[b->id] = mb;
     }
 
-    machine_func.block_head = block_head.next;
-    machine_func.block_count = gcm.block_count;
+    machine_func->block_head = block_head.next;
+    machine_func->block_count = gcm.block_count;
   }
 
   foreach_list(cb_block_t, b, gcm.cfg) {
@@ -1008,7 +2152,7 @@ void cb_generate_x64(cb_func_t* func) {
     mb->successor_count = b->successor_count;
     mb->predecessor_count = b->predecessor_count;
 
-    mb->predecessors = arena_array(scratch.arena, machine_block_t*, mb->predecessor_count);
+    mb->predecessors = arena_array(arena, machine_block_t*, mb->predecessor_count);
 
     for (int i = 0; i < mb->successor_count; ++i) {
       mb->successors[i] = block_map[b->successors[i]->id];
@@ -1022,20 +2166,20 @@ void cb_generate_x64(cb_func_t* func) {
   vec_t(machine_block_t*) stack = NULL;
 
   gen_context_t g = {
-    .arena = scratch.arena,
+    .arena = arena,
     
     .gcm = &gcm,
     .block_map = block_map,
 
     .reg_map = reg_map,
-    .func = &machine_func,
+    .func = machine_func,
     .alloca_map = alloca_map
   };
 
-  vec_put(stack, machine_func.block_head);
+  vec_put(stack, machine_func->block_head);
 
   int phi_count = 0;
-  cb_node_t** phis = arena_array(scratch.arena, cb_node_t*, func->next_id);
+  cb_node_t** phis = arena_array(arena, cb_node_t*, func->next_id);
 
   while (vec_len(stack)) { // generate the blocks in order specified by dominator tree -> defs dominate their uses except for phis
     machine_block_t* mb = vec_pop(stack);
@@ -1064,7 +2208,7 @@ void cb_generate_x64(cb_func_t* func) {
           break;
 
         case CB_NODE_ALLOCA: {
-          alloca_map[node->id] = new_alloca(scratch.arena, &machine_func);
+          alloca_map[node->id] = new_alloca(arena, machine_func);
         } break;
 
         case CB_NODE_PHI: {
@@ -1089,6 +2233,9 @@ void cb_generate_x64(cb_func_t* func) {
       vec_put(mb->code, inst_jmp(g.arena, mb->successors[0]));
       mb->terminator_count = 1;
     }
+    else if (mb->successor_count == 2) {
+      mb->terminator_count = 2; // jz and jmp from branch32
+    }
   }
 
   for (int i = 0; i < phi_count; ++i) {
@@ -1101,7 +2248,7 @@ void cb_generate_x64(cb_func_t* func) {
 
     for (int j = 1; j < phi->num_ins; ++j) {
       cb_node_t* in = phi->ins[j];
-      machine_block_t* pred = block_map[gcm.map[in->id]->id];
+      machine_block_t* pred = block_map[gcm.map[region->ins[j-1]->id]->id]; // the copy belongs on the incoming edge, not where the value is defined
 
       insert_before_n(pred, inst_mov32_rr(g.arena, temp, reg_map[in->id]), pred->terminator_count);
     }
@@ -1109,31 +2256,182 @@ void cb_generate_x64(cb_func_t* func) {
     prepend(mb, inst_mov32_rr(g.arena, reg_map[phi->id], temp));
   }
 
-  dump_func(&machine_func);
-  regalloc(scratch.arena, &machine_func);
+  machine_func->exit_block = block_map[gcm.map[func->end->id]->id];
+
+  rotate_loops(arena, &gcm, block_map);
+  place_blocks(arena, machine_func, &gcm);
+
+  vec_free(stack);
+
+  return machine_func;
+}
+
+int x64_machine_inst_count(machine_func_t* func) {
+  int count = 0;
+
+  foreach_list(machine_block_t, mb, func->block_head) {
+    count += (int)vec_len(mb->code);
+  }
+
+  return count;
+}
+
+static bool patch_fixups(x64_encoder_t* e) {
+  bool relaxed = false;
+
+  for (int i = 0; i < vec_len(e->fixups); ++i) {
+    x64_fixup_t* fixup = &e->fixups[i];
+
+    int target = e->block_offsets[fixup->target->id];
+    assert(target != -1);
+
+    int32_t rel = target - (fixup->at + fixup->size);
+
+    if (fixup->size == 1 && !fits_in_int8(rel)) {
+      e->is_near[fixup->branch] = true;
+      relaxed = true;
+      continue;
+    }
+
+    for (int j = 0; j < fixup->size; ++j) {
+      e->code[fixup->at + j] = (uint8_t)((uint32_t)rel >> (j * 8));
+    }
+  }
+
+  return relaxed;
+}
+
+static cb_code_t encode_func(cb_arena_t* arena, machine_func_t* func) {
+  scratch_t scratch = scratch_get(1, &arena);
+
+  x64_encoder_t e = {
+    .block_offsets = arena_array(scratch.arena, int, func->block_count)
+  };
+
+  // growing a branch can only push others further apart, so this reaches a fixed point
+  do {
+    vec_clear(e.code);
+    vec_clear(e.fixups);
+    e.branch_count = 0;
+
+    for (int i = 0; i < func->block_count; ++i) {
+      e.block_offsets[i] = -1;
+    }
+
+    foreach_list(machine_block_t, mb, func->block_head) {
+      e.block_offsets[mb->id] = (int)vec_len(e.code);
+
+      for (int i = 0; i < vec_len(mb->code); ++i) {
+        encode_inst(&e, &mb->code[i]);
+      }
+    }
+  } while (patch_fixups(&e));
+
+  cb_code_t code = {
+    .size = vec_len(e.code)
+  };
+
+  code.bytes = vec_bake(arena, e.code);
+
+  vec_free(e.fixups);
+  vec_free(e.is_near);
+  scratch_release(&scratch);
+
+  return code;
+}
+
+static bool is_conditional_jump(machine_inst_t* inst) {
+  return inst->op == X64_INST_JZ || inst->op == X64_INST_JNZ;
+}
+
+// drops jumps to the next block in layout, inverting a conditional jump
+// to the next block so the trailing jmp is the one that falls away
+static void eliminate_fall_throughs(machine_func_t* func) {
+  foreach_list(machine_block_t, mb, func->block_head) {
+    int count = (int)vec_len(mb->code);
+
+    if (count == 0 || mb->code[count-1].op != X64_INST_JMP) {
+      continue;
+    }
+
+    machine_inst_t* jmp = &mb->code[count-1];
+
+    if (count >= 2 && is_conditional_jump(&mb->code[count-2])) {
+      machine_inst_t* cond = &mb->code[count-2];
+
+      if ((machine_block_t*)cond->data == mb->next) {
+        uint64_t dest = cond->data;
+
+        cond->op = cond->op == X64_INST_JZ ? X64_INST_JNZ : X64_INST_JZ;
+        cond->data = jmp->data;
+        jmp->data = dest;
+      }
+    }
+
+    if ((machine_block_t*)jmp->data == mb->next) {
+      vec_pop(mb->code);
+      mb->terminator_count--;
+    }
+  }
+}
+
+cb_code_t cb_generate_x64(cb_arena_t* arena, FILE* stream, cb_func_t* func, cb_regalloc_t regalloc_kind) {
+  scratch_t scratch = scratch_get(1, &arena);
+
+  machine_func_t* machine_func = x64_build_machine_func(scratch.arena, func);
+
+  dump_func(stream, machine_func);
+  regalloc(scratch.arena, machine_func, regalloc_kind);
 
   int stack_size = 0; 
 
-  foreach_list(alloca_t, a, machine_func.alloca_head) {
-    a->offset = stack_size;
+  foreach_list(alloca_t, a, machine_func->alloca_head) {
     stack_size += 4;
+    a->offset = stack_size; // slots sit below the saved rbp
   }
 
-  if (stack_size > 0) {
-    machine_inst_t prologue[] = {
-      inst_push64(scratch.arena, PR_EBP),
-      inst_mov64_rr(scratch.arena, PR_EBP, PR_ESP),
-      inst_sub64_ri(scratch.arena, PR_ESP, stack_size)
-    };
+  bool* written = arena_array(scratch.arena, bool, NUM_PRS);
 
-    prepend_n(machine_func.block_head, prologue, ARRAY_LENGTH(prologue));
+  foreach_list(machine_block_t, mb, machine_func->block_head) {
+    for (int i = 0; i < vec_len(mb->code); ++i) {
+      machine_inst_t* inst = mb->code + i;
 
-    machine_block_t* tail = block_map[gcm.map[func->end->id]->id];
-    insert_before_n(tail, inst_leave(scratch.arena), 1);
+      for (int j = 0; j < inst->num_writes; ++j) {
+        written[inst->writes[j]] = true;
+      }
+    }
   }
 
-  dump_func(&machine_func);
+  // callee-saved registers are pushed ahead of the frame so stack slots stay at [rbp-4] and down.
+  // each pop goes in front of the ones already before the ret, so they come out in reverse
+
+  int saved_count = 0;
+  int prologue_count = 0;
+  machine_inst_t prologue[NUM_ALLOCATABLE_PRS + 3];
+
+  for (reg_t pr = 0; pr < NUM_ALLOCATABLE_PRS; ++pr) {
+    if (written[pr] && pr_callee_saved[pr]) {
+      prologue[prologue_count++] = inst_push64(scratch.arena, pr);
+      insert_before_n(machine_func->exit_block, inst_pop64(scratch.arena, pr), 1 + saved_count++);
+    }
+  }
+
+  if (stack_size > 0) {
+    prologue[prologue_count++] = inst_push64(scratch.arena, PR_EBP);
+    prologue[prologue_count++] = inst_mov64_rr(scratch.arena, PR_EBP, PR_ESP);
+    prologue[prologue_count++] = inst_sub64_ri(scratch.arena, PR_ESP, stack_size);
+
+    insert_before_n(machine_func->exit_block, inst_leave(scratch.arena), 1 + saved_count);
+  }
+
+  prepend_n(machine_func->block_head, prologue, prologue_count);
+
+  eliminate_fall_throughs(machine_func);
+  dump_func(stream, machine_func);
+
+  cb_code_t code = encode_func(arena, machine_func);
 
-  vec_free(stack);
   scratch_release(&scratch);
-}
\ No newline at end of file
+
+  return code;
+}
@@ -5,6 +5,16 @@
 #include <assert.h>
 #include <stdbool.h>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// sse2 is part of x86-64, so the bitset kernels below only fall back to scalar code on other targets
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CRINGE_BITSET_SSE2
+#endif
+
 #define BIT(x) (1 << (x))
 
 #define ARRAY_LENGTH(arr) ( sizeof(arr) / sizeof((arr)[0]) )
@@ -21,8 +31,43 @@ void free_arena(arena_t* arena);
 void init_globals();
 void free_globals();
 
-void* arena_push(arena_t* arena, size_t amount);
-void* arena_push_zeroed(arena_t* arena, size_t amount);
+// file and line tag the allocation site, they're only passed when building with CRINGE_ARENA_TAGS
+void* _arena_push(arena_t* arena, size_t amount, char* file, int line);
+void* _arena_push_zeroed(arena_t* arena, size_t amount, char* file, int line);
+
+#ifdef CRINGE_ARENA_TAGS
+  #define arena_push(arena, amount) _arena_push(arena, amount, __FILE__, __LINE__)
+  #define arena_push_zeroed(arena, amount) _arena_push_zeroed(arena, amount, __FILE__, __LINE__)
+#else
+  #define arena_push(arena, amount) _arena_push(arena, amount, NULL, 0)
+  #define arena_push_zeroed(arena, amount) _arena_push_zeroed(arena, amount, NULL, 0)
+#endif
+
+typedef struct {
+  size_t pushed; // bytes ever pushed
+  size_t allocated; // bytes in use right now
+  size_t high_water; // peak of allocated
+  size_t committed;
+} arena_stats_t;
+
+typedef struct {
+  char* file;
+  int line;
+  size_t count;
+  size_t bytes;
+} arena_tag_t;
+
+arena_stats_t arena_get_stats(arena_t* arena);
+arena_stats_t scratch_get_stats(); // this thread's scratch arenas together
+int scratch_peak_depth(); // most scratch_gets outstanding at once on this thread
+
+size_t arena_total_pushed(); // bytes pushed on this thread across all arenas
+size_t arena_total_committed(); // bytes committed on this thread across all arenas, including freed ones
+size_t scratch_take_peak(); // peak scratch usage on this thread since the last call
+
+arena_tag_t* arena_get_tags(int* count); // allocation sites on this thread, empty slots have a NULL file
+
+uint64_t time_now_ns(); // monotonic
 
 #define arena_array(arena, ty, count) ( (ty*)arena_push_zeroed(arena, (count) * sizeof(ty)) )
 #define arena_type(arena, ty) ( (ty*)arena_push_zeroed(arena, sizeof(ty)) )
@@ -77,6 +122,25 @@ size_t _vec_back(void* v);
 #define vec_pop(v) ( (v)[_vec_pop(v)] )
 #define vec_back(v) ( (v)[_vec_back(v)] )
 
+inline int ctz64(uint64_t x) {
+  assert(x);
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward64(&index, x);
+  return (int)index;
+#else
+  return __builtin_ctzll(x);
+#endif
+}
+
+inline int popcount64(uint64_t x) {
+#if defined(_MSC_VER)
+  return (int)__popcnt64(x);
+#else
+  return __builtin_popcountll(x);
+#endif
+}
+
 inline size_t bitset_u64_count(size_t bit_count) {
   return (bit_count + 63) / 64;
 }
@@ -107,12 +171,133 @@ inline void bitset_copy(uint64_t* dest, uint64_t* src, size_t bit_count) {
 
 inline void bitset_or(uint64_t* target, uint64_t* source, size_t bit_count) {
   size_t c = bitset_u64_count(bit_count);
+  size_t i = 0;
 
-  for (size_t i = 0; i < c; ++i) {
+#ifdef CRINGE_BITSET_SSE2
+  for (; i + 2 <= c; i += 2) {
+    __m128i t = _mm_loadu_si128((__m128i*)(target + i));
+    __m128i s = _mm_loadu_si128((__m128i*)(source + i));
+    _mm_storeu_si128((__m128i*)(target + i), _mm_or_si128(t, s));
+  }
+#endif
+
+  for (; i < c; ++i) {
     target[i] |= source[i];
   }
 }
 
+inline void bitset_and(uint64_t* target, uint64_t* source, size_t bit_count) {
+  size_t c = bitset_u64_count(bit_count);
+  size_t i = 0;
+
+#ifdef CRINGE_BITSET_SSE2
+  for (; i + 2 <= c; i += 2) {
+    __m128i t = _mm_loadu_si128((__m128i*)(target + i));
+    __m128i s = _mm_loadu_si128((__m128i*)(source + i));
+    _mm_storeu_si128((__m128i*)(target + i), _mm_and_si128(t, s));
+  }
+#endif
+
+  for (; i < c; ++i) {
+    target[i] &= source[i];
+  }
+}
+
+// dest = a & ~b
+inline void bitset_andnot(uint64_t* dest, uint64_t* a, uint64_t* b, size_t bit_count) {
+  size_t c = bitset_u64_count(bit_count);
+  size_t i = 0;
+
+#ifdef CRINGE_BITSET_SSE2
+  for (; i + 2 <= c; i += 2) {
+    __m128i x = _mm_loadu_si128((__m128i*)(a + i));
+    __m128i y = _mm_loadu_si128((__m128i*)(b + i));
+    _mm_storeu_si128((__m128i*)(dest + i), _mm_andnot_si128(y, x));
+  }
+#endif
+
+  for (; i < c; ++i) {
+    dest[i] = a[i] & ~b[i];
+  }
+}
+
+// returns whether target gained any bits
+inline bool bitset_or_changed(uint64_t* target, uint64_t* source, size_t bit_count) {
+  size_t c = bitset_u64_count(bit_count);
+  size_t i = 0;
+
+  uint64_t gained = 0;
+
+#ifdef CRINGE_BITSET_SSE2
+  __m128i gained_wide = _mm_setzero_si128();
+
+  for (; i + 2 <= c; i += 2) {
+    __m128i t = _mm_loadu_si128((__m128i*)(target + i));
+    __m128i s = _mm_loadu_si128((__m128i*)(source + i));
+    gained_wide = _mm_or_si128(gained_wide, _mm_andnot_si128(t, s));
+    _mm_storeu_si128((__m128i*)(target + i), _mm_or_si128(t, s));
+  }
+
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(gained_wide, _mm_setzero_si128())) != 0xffff) {
+    gained = 1;
+  }
+#endif
+
+  for (; i < c; ++i) {
+    gained |= source[i] & ~target[i];
+    target[i] |= source[i];
+  }
+
+  return gained != 0;
+}
+
+inline size_t bitset_popcount(uint64_t* bs, size_t bit_count) {
+  size_t c = bitset_u64_count(bit_count);
+  size_t count = 0;
+
+  for (size_t i = 0; i < c; ++i) {
+    count += popcount64(bs[i]);
+  }
+
+  return count;
+}
+
+// walks the set bits a word at a time, so the cost follows the number of set bits rather than bit_count
+typedef struct {
+  uint64_t* bs;
+  size_t word_count;
+  size_t word;
+  uint64_t bits;
+} bitset_iter_t;
+
+inline bitset_iter_t bitset_iter(uint64_t* bs, size_t bit_count) {
+  bitset_iter_t it = {
+    .bs = bs,
+    .word_count = bitset_u64_count(bit_count),
+  };
+
+  if (it.word_count) {
+    it.bits = bs[0];
+  }
+
+  return it;
+}
+
+inline bool bitset_next(bitset_iter_t* it, size_t* index) {
+  while (!it->bits) {
+    if (++it->word >= it->word_count) {
+      return false;
+    }
+
+    it->bits = it->bs[it->word];
+  }
+
+  *index = it->word * 64 + ctz64(it->bits);
+  it->bits &= it->bits - 1;
+
+  return true;
+}
+
 typedef struct {
   size_t len;
   char* str;
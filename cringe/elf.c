@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "elf.h"
+
+#define ELF_TEXT_ALIGNMENT 16
+
+enum {
+  SHT_NULL = 0,
+  SHT_PROGBITS = 1,
+  SHT_SYMTAB = 2,
+  SHT_STRTAB = 3,
+};
+
+enum {
+  SHF_ALLOC = 0x2,
+  SHF_EXECINSTR = 0x4,
+};
+
+enum {
+  STB_GLOBAL = 1,
+  STT_FUNC = 2,
+};
+
+#define ET_REL 1
+#define EM_X86_64 62
+
+typedef enum {
+  SECTION_NULL,
+  SECTION_TEXT,
+  SECTION_SYMTAB,
+  SECTION_STRTAB,
+  SECTION_SHSTRTAB,
+  SECTION_NOTE_GNU_STACK, // empty, marks the stack as non-executable
+
+  NUM_SECTIONS
+} section_t;
+
+static char* section_names[NUM_SECTIONS] = {
+  [SECTION_NULL] = "",
+  [SECTION_TEXT] = ".text",
+  [SECTION_SYMTAB] = ".symtab",
+  [SECTION_STRTAB] = ".strtab",
+  [SECTION_SHSTRTAB] = ".shstrtab",
+  [SECTION_NOTE_GNU_STACK] = ".note.GNU-stack",
+};
+
+typedef struct {
+  uint8_t ident[16];
+  uint16_t type;
+  uint16_t machine;
+  uint32_t version;
+  uint64_t entry;
+  uint64_t phoff;
+  uint64_t shoff;
+  uint32_t flags;
+  uint16_t ehsize;
+  uint16_t phentsize;
+  uint16_t phnum;
+  uint16_t shentsize;
+  uint16_t shnum;
+  uint16_t shstrndx;
+} elf_header_t;
+
+typedef struct {
+  uint32_t name;
+  uint32_t type;
+  uint64_t flags;
+  uint64_t addr;
+  uint64_t offset;
+  uint64_t size;
+  uint32_t link;
+  uint32_t info;
+  uint64_t addralign;
+  uint64_t entsize;
+} elf_section_header_t;
+
+typedef struct {
+  uint32_t name;
+  uint8_t info;
+  uint8_t other;
+  uint16_t shndx;
+  uint64_t value;
+  uint64_t size;
+} elf_symbol_t;
+
+_Static_assert(sizeof(elf_header_t) == 64, "elf header layout");
+_Static_assert(sizeof(elf_section_header_t) == 64, "elf section header layout");
+_Static_assert(sizeof(elf_symbol_t) == 24, "elf symbol layout");
+
+typedef struct elf_func_t elf_func_t;
+struct elf_func_t {
+  elf_func_t* next;
+  char* name;
+  uint8_t* code;
+  size_t size;
+  size_t offset; // into .text
+};
+
+struct elf_writer_t {
+  arena_t* arena;
+
+  elf_func_t* func_head;
+  elf_func_t* func_tail;
+
+  size_t text_size;
+};
+
+elf_writer_t* elf_new_writer(arena_t* arena) {
+  elf_writer_t* writer = arena_type(arena, elf_writer_t);
+  writer->arena = arena;
+  return writer;
+}
+
+void elf_add_func(elf_writer_t* writer, char* name, uint8_t* code, size_t size) {
+  elf_func_t* func = arena_type(writer->arena, elf_func_t);
+  func->name = name;
+  func->code = code;
+  func->size = size;
+
+  writer->text_size = (writer->text_size + ELF_TEXT_ALIGNMENT - 1) & ~(size_t)(ELF_TEXT_ALIGNMENT - 1);
+  func->offset = writer->text_size;
+  writer->text_size += size;
+
+  if (writer->func_tail) {
+    writer->func_tail = writer->func_tail->next = func;
+  }
+  else {
+    writer->func_head = writer->func_tail = func;
+  }
+}
+
+static void put_bytes(vec_t(uint8_t)* buffer, const void* data, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    vec_put(*buffer, ((uint8_t*)data)[i]);
+  }
+}
+
+static void pad_to(vec_t(uint8_t)* buffer, size_t alignment, uint8_t fill) {
+  while (vec_len(*buffer) % alignment) {
+    vec_put(*buffer, fill);
+  }
+}
+
+static uint32_t put_string(vec_t(uint8_t)* table, char* string) {
+  uint32_t offset = (uint32_t)vec_len(*table);
+  put_bytes(table, string, strlen(string) + 1);
+  return offset;
+}
+
+bool elf_write(elf_writer_t* writer, char* path) {
+  // symbols: the null one, then a global per function
+
+  vec_t(elf_symbol_t) symbols = NULL;
+  vec_t(uint8_t) strtab = NULL;
+  vec_t(uint8_t) shstrtab = NULL;
+
+  elf_symbol_t null_symbol = {0};
+  vec_put(symbols, null_symbol);
+  put_string(&strtab, "");
+
+  foreach_list(elf_func_t, func, writer->func_head) {
+    elf_symbol_t symbol = {
+      .name = put_string(&strtab, func->name),
+      .info = (STB_GLOBAL << 4) | STT_FUNC,
+      .shndx = SECTION_TEXT,
+      .value = func->offset,
+      .size = func->size
+    };
+
+    vec_put(symbols, symbol);
+  }
+
+  uint32_t section_name[NUM_SECTIONS];
+
+  for (int i = 0; i < NUM_SECTIONS; ++i) {
+    section_name[i] = put_string(&shstrtab, section_names[i]);
+  }
+
+  // lay the file out in one buffer so it goes to disk in a single write
+
+  vec_t(uint8_t) file = NULL;
+  elf_section_header_t sections[NUM_SECTIONS] = {0};
+
+  elf_header_t header = {
+    .ident = { 0x7f, 'E', 'L', 'F', 2 /*64 bit*/, 1 /*little endian*/, 1 /*version*/ },
+    .type = ET_REL,
+    .machine = EM_X86_64,
+    .version = 1,
+    .ehsize = sizeof(elf_header_t),
+    .shentsize = sizeof(elf_section_header_t),
+    .shnum = NUM_SECTIONS,
+    .shstrndx = SECTION_SHSTRTAB
+  };
+
+  put_bytes(&file, &header, sizeof(header));
+
+  pad_to(&file, ELF_TEXT_ALIGNMENT, 0);
+  sections[SECTION_TEXT] = (elf_section_header_t) {
+    .type = SHT_PROGBITS,
+    .flags = SHF_ALLOC | SHF_EXECINSTR,
+    .offset = vec_len(file),
+    .size = writer->text_size,
+    .addralign = ELF_TEXT_ALIGNMENT
+  };
+
+  foreach_list(elf_func_t, func, writer->func_head) {
+    pad_to(&file, ELF_TEXT_ALIGNMENT, 0xCC);
+    put_bytes(&file, func->code, func->size);
+  }
+
+  pad_to(&file, 8, 0);
+  sections[SECTION_SYMTAB] = (elf_section_header_t) {
+    .type = SHT_SYMTAB,
+    .offset = vec_len(file),
+    .size = vec_len(symbols) * sizeof(elf_symbol_t),
+    .link = SECTION_STRTAB,
+    .info = 1, // index of the first global, only the null symbol is local
+    .addralign = 8,
+    .entsize = sizeof(elf_symbol_t)
+  };
+
+  put_bytes(&file, symbols, vec_len(symbols) * sizeof(elf_symbol_t));
+
+  sections[SECTION_STRTAB] = (elf_section_header_t) {
+    .type = SHT_STRTAB,
+    .offset = vec_len(file),
+    .size = vec_len(strtab),
+    .addralign = 1
+  };
+
+  put_bytes(&file, strtab, vec_len(strtab));
+
+  sections[SECTION_SHSTRTAB] = (elf_section_header_t) {
+    .type = SHT_STRTAB,
+    .offset = vec_len(file),
+    .size = vec_len(shstrtab),
+    .addralign = 1
+  };
+
+  put_bytes(&file, shstrtab, vec_len(shstrtab));
+
+  sections[SECTION_NOTE_GNU_STACK] = (elf_section_header_t) {
+    .type = SHT_PROGBITS,
+    .offset = vec_len(file),
+    .addralign = 1
+  };
+
+  for (int i = 0; i < NUM_SECTIONS; ++i) {
+    sections[i].name = section_name[i];
+  }
+
+  pad_to(&file, 8, 0);
+  header.shoff = vec_len(file);
+  memcpy(file, &header, sizeof(header));
+
+  put_bytes(&file, sections, sizeof(sections));
+
+  bool success = false;
+  FILE* stream;
+
+  if (!fopen_s(&stream, path, "wb")) {
+    success = fwrite(file, 1, vec_len(file), stream) == vec_len(file);
+    success &= fclose(stream) == 0;
+  }
+
+  vec_free(file);
+  vec_free(symbols);
+  vec_free(strtab);
+  vec_free(shstrtab);
+
+  return success;
+}
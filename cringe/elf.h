@@ -0,0 +1,14 @@
+#pragma once
+
+#include "base.h"
+
+// Writes x86-64 ELF relocatable objects for the system linker. Each function becomes a global FUNC
+// symbol in .text. The backend doesn't emit calls yet, so there's nothing to relocate.
+
+typedef struct elf_writer_t elf_writer_t;
+
+elf_writer_t* elf_new_writer(arena_t* arena);
+
+void elf_add_func(elf_writer_t* writer, char* name, uint8_t* code, size_t size); // copies nothing, code must outlive the writer
+
+bool elf_write(elf_writer_t* writer, char* path); // false if the file couldn't be written
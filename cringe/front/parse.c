@@ -465,6 +465,10 @@ static bool handle_complete_binary(parser_t* p, token_t op) {
         make_inst(p, SEM_INST_CAST, op, ty, 1, NULL);
       }
     }
+    else {
+      push_value(p, left);
+      push_value(p, right);
+    }
 
     make_inst(p, bin_kind(op), op, ty, 2, NULL);
     return true;
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// The stat and trace hooks the compiler itself calls. Nothing else is included here so the frontend and
+// backend can record into them without depending on the driver. stats.h and trace.h hold the rest.
+
+#define X(name, ...) STAT_PHASE_##name,
+typedef enum {
+  #include "stat_phase.def"
+  NUM_STAT_PHASES
+} stat_phase_t;
+#undef X
+
+#define X(name, ...) STAT_##name,
+typedef enum {
+  #include "stat_counter.def"
+  NUM_STAT_COUNTERS
+} stat_counter_t;
+#undef X
+
+void stats_begin_phase(stat_phase_t phase);
+void stats_end_phase(stat_phase_t phase);
+
+void stats_count(stat_counter_t counter, uint64_t amount);
+void stats_count_idealized(int node_kind);
+
+extern bool trace_on;
+
+void _trace_begin(char* name, char* detail);
+void _trace_end();
+
+// name and detail must outlive the trace, detail can be NULL
+#define trace_begin(name, detail) ( trace_on ? _trace_begin(name, detail) : (void)0 )
+#define trace_end() ( trace_on ? _trace_end() : (void)0 )
@@ -0,0 +1,143 @@
+#if defined(_WIN32)
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #ifndef _DEFAULT_SOURCE
+    #define _DEFAULT_SOURCE // MAP_ANONYMOUS isn't in strict c11
+  #endif
+  #include <sys/mman.h>
+#endif
+
+#include <string.h>
+
+#include "jit.h"
+
+#define JIT_FUNC_ALIGNMENT 16
+
+typedef struct jit_func_t jit_func_t;
+struct jit_func_t {
+  jit_func_t* next;
+  char* name;
+  uint8_t* code;
+  size_t size;
+  size_t offset; // from the start of the pages
+};
+
+struct jit_module_t {
+  arena_t* arena;
+
+  jit_func_t* func_head;
+  jit_func_t* func_tail;
+
+  size_t size;
+  uint8_t* pages;
+  bool finalized;
+};
+
+static void* map_pages(size_t size) {
+#if defined(_WIN32)
+  return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+  void* pages = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return pages == MAP_FAILED ? NULL : pages;
+#endif
+}
+
+static bool make_executable(void* pages, size_t size) {
+#if defined(_WIN32)
+  DWORD old_protect;
+
+  if (!VirtualProtect(pages, size, PAGE_EXECUTE_READ, &old_protect)) {
+    return false;
+  }
+
+  return FlushInstructionCache(GetCurrentProcess(), pages, size);
+#else
+  return mprotect(pages, size, PROT_READ | PROT_EXEC) == 0;
+#endif
+}
+
+static void unmap_pages(void* pages, size_t size) {
+#if defined(_WIN32)
+  (void)size;
+  VirtualFree(pages, 0, MEM_RELEASE);
+#else
+  munmap(pages, size);
+#endif
+}
+
+jit_module_t* jit_new_module(arena_t* arena) {
+  jit_module_t* module = arena_type(arena, jit_module_t);
+  module->arena = arena;
+  return module;
+}
+
+void jit_free_module(jit_module_t* module) {
+  if (module->pages) {
+    unmap_pages(module->pages, module->size);
+    module->pages = NULL;
+  }
+}
+
+void jit_add_func(jit_module_t* module, char* name, uint8_t* code, size_t size) {
+  assert(!module->finalized);
+
+  jit_func_t* func = arena_type(module->arena, jit_func_t);
+  func->name = name;
+  func->code = code;
+  func->size = size;
+
+  module->size = (module->size + JIT_FUNC_ALIGNMENT - 1) & ~(size_t)(JIT_FUNC_ALIGNMENT - 1);
+  func->offset = module->size;
+  module->size += size;
+
+  if (module->func_tail) {
+    module->func_tail = module->func_tail->next = func;
+  }
+  else {
+    module->func_head = module->func_tail = func;
+  }
+}
+
+bool jit_finalize(jit_module_t* module) {
+  assert(!module->finalized);
+
+  if (module->size == 0) {
+    module->finalized = true;
+    return true;
+  }
+
+  module->pages = map_pages(module->size);
+
+  if (!module->pages) {
+    return false;
+  }
+
+  memset(module->pages, 0xCC, module->size); // padding between functions traps
+
+  foreach_list(jit_func_t, func, module->func_head) {
+    memcpy(module->pages + func->offset, func->code, func->size);
+  }
+
+  if (!make_executable(module->pages, module->size)) {
+    jit_free_module(module);
+    return false;
+  }
+
+  module->finalized = true;
+  return true;
+}
+
+void* jit_get_symbol(jit_module_t* module, char* name) {
+  if (!module->finalized) {
+    return NULL;
+  }
+
+  foreach_list(jit_func_t, func, module->func_head) {
+    if (strcmp(func->name, name) == 0) {
+      return module->pages + func->offset;
+    }
+  }
+
+  return NULL;
+}
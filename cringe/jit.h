@@ -0,0 +1,16 @@
+#pragma once
+
+#include "base.h"
+
+// Runs generated code in-process. jit_finalize copies every added function into pages that are mapped
+// read-write, then flips them to read-execute, after which their addresses can be looked up by name.
+
+typedef struct jit_module_t jit_module_t;
+
+jit_module_t* jit_new_module(arena_t* arena);
+void jit_free_module(jit_module_t* module);
+
+void jit_add_func(jit_module_t* module, char* name, uint8_t* code, size_t size); // the code is only copied by jit_finalize, so it has to outlive that call
+bool jit_finalize(jit_module_t* module); // false if the pages couldn't be mapped or made executable
+
+void* jit_get_symbol(jit_module_t* module, char* name); // NULL if there's no such function or the module isn't finalized
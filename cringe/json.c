@@ -0,0 +1,19 @@
+#include "json.h"
+
+void fprint_json_string(FILE* file, char* str) {
+  fputc('"', file);
+
+  for (unsigned char* c = (unsigned char*)str; *c; ++c) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(file, "\\%c", *c);
+    }
+    else if (*c < 0x20) {
+      fprintf(file, "\\u%04x", *c);
+    }
+    else {
+      fputc(*c, file);
+    }
+  }
+
+  fputc('"', file);
+}
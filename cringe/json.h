@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdio.h>
+
+// Small helpers shared by the json the driver writes (-stats=json and -trace).
+
+void fprint_json_string(FILE* file, char* str); // quoted and escaped, for paths and names that can hold backslashes
@@ -1,15 +1,383 @@
+#if defined(_WIN32)
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #ifndef _DEFAULT_SOURCE
+    #define _DEFAULT_SOURCE // mkstemp and fdopen aren't in strict c11
+  #endif
+  #include <unistd.h>
+#endif
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include "base.h"
+#include "stats.h"
+#include "trace.h"
+#include "jit.h"
+#include "elf.h"
 #include "front/front.h"
 #include "back/cb.h"
 
-int main() {
+typedef struct {
+  char* path;
+  bool dump;
+
+  bool stats;
+  bool stats_perf;
+  stats_format_t stats_format;
+
+  char* trace_path;
+  char* output_path;
+
+  bool run;
+  bool dump_code;
+  bool disasm;
+
+  int opt_level;
+  int regalloc; // a cb_regalloc_t, or -1 to leave it to the opt level
+  int pass_toggles[NUM_CB_PASSES]; // -1 off, 1 on, 0 leave it to the opt level
+  int pass_limits[NUM_CB_PASSES];
+} options_t;
+
+static void print_usage(char* exe) {
+  printf("Usage: %s [options] [file]\n", exe);
+  printf("  -O<0-2>            optimization level (default -O2)\n");
+  printf("  -f<pass>           enable a backend pass\n");
+  printf("  -fno-<pass>        disable a backend pass\n");
+  printf("  -f<pass>-limit=<n> run a backend pass at most n times per function, n >= 1\n");
+  printf("  -regalloc=<kind>   graph or linear register allocation (default linear at -O0)\n");
+  printf("  -quiet             don't dump the intermediate representations\n");
+  printf("  -stats[=json]      print per-phase timings and IR statistics\n");
+  printf("  -stats-perf        include hardware performance counters in the statistics\n");
+  printf("  -trace=<file>      write a chrome trace-event timeline of the compile\n");
+  printf("  -o <file>          write an elf object with every function in the unit\n");
+  printf("  -run               jit the generated code, call main and print what it returns\n");
+  printf("  -dump-code         print the encoded machine code as hex\n");
+  printf("  -disasm            disassemble the encoded machine code with objdump\n");
+  printf("passes:");
+
+  for (int i = 0; i < NUM_CB_PASSES; ++i) {
+    printf(" %s", cb_pass_label(i));
+  }
+
+  printf("\n");
+}
+
+static bool parse_pass_flag(options_t* options, char* flag) {
+  char name[64];
+  int toggle = 1;
+
+  if (strncmp(flag, "no-", 3) == 0) {
+    flag += 3;
+    toggle = -1;
+  }
+
+  char* limit = strstr(flag, "-limit=");
+  size_t name_len = limit ? (size_t)(limit - flag) : strlen(flag);
+
+  if (name_len >= sizeof(name)) {
+    return false;
+  }
+
+  memcpy(name, flag, name_len);
+  name[name_len] = '\0';
+
+  cb_pass_t pass = cb_find_pass(name);
+
+  if (pass == NUM_CB_PASSES) {
+    return false;
+  }
+
+  if (limit) {
+    if (toggle == -1) {
+      return false;
+    }
+
+    char* digits = limit + strlen("-limit=");
+    char* end;
+    long value = strtol(digits, &end, 10);
+
+    if (end == digits || *end != '\0' || value < 1 || value > INT_MAX) { // 0 is the no limit default, -fno-<pass> turns a pass off
+      return false;
+    }
+
+    options->pass_limits[pass] = (int)value;
+  }
+  else {
+    options->pass_toggles[pass] = toggle;
+  }
+
+  return true;
+}
+
+static bool parse_options(options_t* options, int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    char* arg = argv[i];
+
+    if (arg[0] != '-') {
+      options->path = arg;
+    }
+    else if (arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '2' && arg[3] == '\0') {
+      options->opt_level = arg[2] - '0';
+    }
+    else if (arg[1] == 'f' && parse_pass_flag(options, arg + 2)) {
+    }
+    else if (strcmp(arg, "-regalloc=graph") == 0) {
+      options->regalloc = CB_REGALLOC_GRAPH_COLORING;
+    }
+    else if (strcmp(arg, "-regalloc=linear") == 0) {
+      options->regalloc = CB_REGALLOC_LINEAR_SCAN;
+    }
+    else if (strcmp(arg, "-quiet") == 0) {
+      options->dump = false;
+    }
+    else if (strcmp(arg, "-stats") == 0) {
+      options->stats = true;
+      options->stats_format = STATS_FORMAT_TABLE;
+    }
+    else if (strcmp(arg, "-stats=json") == 0) {
+      options->stats = true;
+      options->stats_format = STATS_FORMAT_JSON;
+    }
+    else if (strcmp(arg, "-stats-perf") == 0) {
+      options->stats = true;
+      options->stats_perf = true;
+    }
+    else if (strncmp(arg, "-trace=", 7) == 0 && arg[7] != '\0') {
+      options->trace_path = arg + 7;
+    }
+    else if (strcmp(arg, "-o") == 0 && i + 1 < argc) {
+      options->output_path = argv[++i];
+    }
+    else if (strcmp(arg, "-run") == 0) {
+      options->run = true;
+    }
+    else if (strcmp(arg, "-dump-code") == 0) {
+      options->dump_code = true;
+    }
+    else if (strcmp(arg, "-disasm") == 0) {
+      options->disasm = true;
+    }
+    else {
+      printf("Unknown option '%s'\n", arg);
+      print_usage(argv[0]);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static cb_opt_options_t get_opt_options(options_t* options) {
+  cb_opt_options_t opt_options = cb_opt_level_options(options->opt_level);
+
+  for (int i = 0; i < NUM_CB_PASSES; ++i) {
+    if (options->pass_toggles[i]) {
+      opt_options.enabled[i] = options->pass_toggles[i] > 0;
+    }
+
+    opt_options.max_runs[i] = options->pass_limits[i];
+  }
+
+  return opt_options;
+}
+
+static void dump_code(FILE* stream, cb_code_t code) {
+  for (size_t i = 0; i < code.size; ++i) {
+    fprintf(stream, "%02x%c", code.bytes[i], (i % 16 == 15 || i == code.size-1) ? '\n' : ' ');
+  }
+}
+
+// the name comes from the os, so parallel runs don't share the file and nothing in the working directory is clobbered
+static FILE* open_temp_file(char* path, size_t path_size) {
+#if defined(_WIN32)
+  char dir[MAX_PATH];
+  DWORD dir_length = GetTempPathA(MAX_PATH, dir);
+
+  if (dir_length == 0 || dir_length > MAX_PATH || path_size < MAX_PATH || !GetTempFileNameA(dir, "cri", 0, path)) {
+    return NULL;
+  }
+
+  FILE* file;
+  return fopen_s(&file, path, "wb") ? NULL : file;
+#else
+  char* dir = getenv("TMPDIR");
+  int length = snprintf(path, path_size, "%s/cringe_disasm_XXXXXX", dir && *dir ? dir : "/tmp");
+
+  if (length < 0 || (size_t)length >= path_size) {
+    return NULL;
+  }
+
+  int fd = mkstemp(path);
+
+  if (fd < 0) {
+    return NULL;
+  }
+
+  FILE* file = fdopen(fd, "wb");
+
+  if (!file) {
+    close(fd);
+    remove(path);
+  }
+
+  return file;
+#endif
+}
+
+// objdump only reads files, so the bytes go through a temporary one
+static void disassemble_code(cb_code_t code) {
+  char path[512];
+  FILE* file = open_temp_file(path, sizeof(path));
+
+  if (!file) {
+    printf("Failed to create a temporary file for disassembly\n");
+    return;
+  }
+
+  bool written = fwrite(code.bytes, 1, code.size, file) == code.size;
+  written &= fclose(file) == 0;
+
+  char command[1024];
+  int length = snprintf(command, sizeof(command), "objdump -D -b binary -m i386:x86-64 -M intel --no-show-raw-insn \"%s\"", path);
+
+  if (!written || length < 0 || (size_t)length >= sizeof(command)) {
+    printf("Failed to write '%s' for disassembly\n", path);
+    remove(path);
+    return;
+  }
+
+  fflush(stdout);
+
+  if (system(command) != 0) {
+    printf("Failed to run objdump\n");
+  }
+
+  remove(path);
+}
+
+static bool run_main(jit_module_t* module) {
+  if (!jit_finalize(module)) {
+    printf("Failed to map executable memory\n");
+    return false;
+  }
+
+  void* symbol = jit_get_symbol(module, "main");
+
+  if (!symbol) {
+    printf("No main func!\n");
+    return false;
+  }
+
+  int (*func)(void);
+  memcpy(&func, &symbol, sizeof(func)); // iso c has no cast from object to function pointers
+
+  printf("main returned %d\n", func());
+
+  jit_free_module(module);
+  return true;
+}
+
+static bool any_pass_enabled(cb_opt_options_t* opt_options) {
+  for (int i = 0; i < NUM_CB_PASSES; ++i) {
+    if (opt_options->enabled[i]) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static cb_code_t compile_func(arena_t* arena, options_t* options, cb_opt_context_t* opt, cb_opt_options_t* opt_options, sem_func_t* func) {
+  stats_set_func(func->name);
+
+  trace_begin("sem_lower", func->name);
+  stats_begin_phase(STAT_PHASE_SEM_LOWER);
+  cb_func_t* cb_func = sem_lower(arena, func);
+  stats_end_phase(STAT_PHASE_SEM_LOWER);
+  trace_end();
+
+  if (options->dump) {
+    cb_graphviz_func(stdout, cb_func);
+  }
+
+  if (any_pass_enabled(opt_options)) {
+    trace_begin("cb_opt_func", func->name);
+    stats_begin_phase(STAT_PHASE_OPT);
+    cb_opt_func(opt, cb_func);
+    stats_end_phase(STAT_PHASE_OPT);
+    trace_end();
+
+    if (options->dump) {
+      cb_graphviz_func(stdout, cb_func);
+    }
+  }
+
+  trace_begin("cb_select_x64", func->name);
+  stats_begin_phase(STAT_PHASE_SELECT_X64);
+  cb_func_t* x64_func = cb_select_x64(arena, cb_func);
+  stats_end_phase(STAT_PHASE_SELECT_X64);
+  trace_end();
+
+  if (options->dump) {
+    cb_graphviz_func(stdout, x64_func);
+    cb_dump_func(stdout, cb_func);
+    cb_dump_func(stdout, x64_func);
+  }
+
+  cb_regalloc_t regalloc = options->regalloc == -1 ? cb_opt_level_regalloc(options->opt_level) : (cb_regalloc_t)options->regalloc;
+
+  trace_begin("cb_generate_x64", func->name);
+  stats_begin_phase(STAT_PHASE_GENERATE_X64);
+  cb_code_t code = cb_generate_x64(arena, options->dump ? stdout : NULL, x64_func, regalloc);
+  stats_end_phase(STAT_PHASE_GENERATE_X64);
+  trace_end();
+
+  if (options->dump_code) {
+    dump_code(stdout, code);
+  }
+
+  if (options->disasm) {
+    disassemble_code(code);
+  }
+
+  return code;
+}
+
+int main(int argc, char** argv) {
+  options_t options = {
+    .path = "examples/test.c",
+    .dump = true,
+    .opt_level = 2,
+    .regalloc = -1
+  };
+
+  if (!parse_options(&options, argc, argv)) {
+    return 1;
+  }
+
   init_globals();
   arena_t* arena = new_arena();
 
-  char* path = "examples/test.c";
+  if (options.stats) {
+    stats_enable();
+    stats_track_arena("main", arena);
+
+    if (options.stats_perf && !stats_enable_perf()) {
+      printf("Hardware performance counters are unavailable, reporting timings only\n");
+    }
+  }
+
+  if (options.trace_path) {
+    trace_enable(options.trace_path);
+  }
+
+  char* path = options.path;
+
+  trace_begin("load_source", path);
 
   FILE* file; 
   if (fopen_s(&file, path, "r")) {
@@ -25,58 +393,83 @@ int main() {
   size_t source_length = fread(source, 1, file_length, file);
   source[source_length] = '\0';
 
+  trace_end();
+
   lexer_t lexer = lexer_init(path, source);
+
+  trace_begin("parse_unit", path); // lexing is pulled on demand by the parser
+  stats_begin_phase(STAT_PHASE_PARSE);
   sem_unit_t* sem_unit = parse_unit(arena, &lexer);
+  stats_end_phase(STAT_PHASE_PARSE);
+  trace_end();
 
   if (!sem_unit) {
     return 1;
   }
 
-  printf("Pre-analysis\n");
-  sem_dump_unit(stdout, sem_unit);
+  if (options.dump) {
+    printf("Pre-analysis\n");
+    sem_dump_unit(stdout, sem_unit);
+  }
 
 
   bool success = true;
 
   foreach_list(sem_func_t, func, sem_unit->funcs) {
+    stats_set_func(func->name);
+
+    trace_begin("sem_analyze", func->name);
+    stats_begin_phase(STAT_PHASE_SEM_ANALYZE);
     success &= sem_analyze(path, source, func);
+    stats_end_phase(STAT_PHASE_SEM_ANALYZE);
+    trace_end();
   }
 
+  stats_set_func(NULL);
+
   if (!success) {
     return 1;
   }
 
-  printf("Post-analysis\n");
+  if (options.dump) {
+    printf("Post-analysis\n");
+    sem_dump_unit(stdout, sem_unit);
+  }
 
-  sem_dump_unit(stdout, sem_unit);
+  cb_opt_options_t opt_options = get_opt_options(&options);
+
+  cb_opt_context_t* opt = cb_new_opt_context();
+  cb_set_opt_options(opt, &opt_options);
 
-  sem_func_t* main = NULL;
+  jit_module_t* jit = options.run ? jit_new_module(arena) : NULL;
+  elf_writer_t* elf = options.output_path ? elf_new_writer(arena) : NULL;
 
-  foreach_list(sem_func_t, sem_func, sem_unit->funcs) {
-    if (strcmp(sem_func->name, "main") == 0) {
-      main = sem_func;
-      break;
+  foreach_list(sem_func_t, func, sem_unit->funcs) {
+    cb_code_t code = compile_func(arena, &options, opt, &opt_options, func);
+
+    if (jit) {
+      jit_add_func(jit, func->name, code.bytes, code.size);
     }
-  }
 
-  if (!main) {
-    printf("No main func!\n");
-    return 1;
+    if (elf) {
+      elf_add_func(elf, func->name, code.bytes, code.size);
+    }
   }
 
-  cb_opt_context_t* opt = cb_new_opt_context();
+  stats_set_func(NULL);
 
-  cb_func_t* cb_func = sem_lower(arena, main);
-  cb_graphviz_func(stdout, cb_func);
-  cb_opt_func(opt, cb_func);
-  cb_graphviz_func(stdout, cb_func);
+  if (elf && !elf_write(elf, options.output_path)) {
+    printf("Failed to write '%s'\n", options.output_path);
+    return 1;
+  }
 
-  cb_func_t* x64_func = cb_select_x64(arena, cb_func);
-  cb_graphviz_func(stdout, x64_func);
+  if (jit && !run_main(jit)) {
+    return 1;
+  }
 
-  cb_dump_func(stdout, cb_func);
-  cb_dump_func(stdout, x64_func);
-  cb_generate_x64(x64_func);
+  if (options.stats) {
+    stats_report(stdout, options.stats_format);
+  }
 
   return 0;
 }
\ No newline at end of file
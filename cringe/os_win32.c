@@ -5,6 +5,7 @@
 #include "base.h"
 
 #define ARENA_CAPACITY ((size_t)5 * 1024 * 1024 * 1024) // May need to increase this?
+#define MAX_ARENA_TAGS 1024 // power of two
 
 struct cringe_arena_t {
   void* base;
@@ -15,10 +16,24 @@ struct cringe_arena_t {
 
   size_t capacity;
   size_t allocated;
+
+  size_t pushed;
+  size_t high_water;
+  bool is_scratch;
 };
 
 thread_local arena_t* scratch_arenas[2];
 
+thread_local size_t total_pushed;
+thread_local size_t total_committed;
+
+thread_local int scratch_depth;
+thread_local int scratch_max_depth;
+thread_local size_t scratch_high_water;
+thread_local size_t scratch_window_peak;
+
+thread_local arena_tag_t arena_tags[MAX_ARENA_TAGS];
+
 arena_t* new_arena() {
   arena_t* arena = LocalAlloc(LMEM_ZEROINIT, sizeof(arena_t));
 
@@ -47,6 +62,7 @@ void free_arena(arena_t* arena) {
 void init_globals() {
   for (int i = 0; i < ARRAY_LENGTH(scratch_arenas); ++i) {
     scratch_arenas[i] = new_arena();
+    scratch_arenas[i]->is_scratch = true;
   }
 }
 
@@ -72,6 +88,10 @@ scratch_t scratch_get(int conflict_count, arena_t** conflicts) {
     }
 
     if (!any_conflict) {
+      if (++scratch_depth > scratch_max_depth) {
+        scratch_max_depth = scratch_depth;
+      }
+
       return (scratch_t) {
         .arena = arena,
         .impl = (void*)arena->allocated,
@@ -95,9 +115,43 @@ void scratch_release(scratch_t* scratch) {
 #endif
 
   arena->allocated = save;
+
+  assert(scratch_depth > 0);
+  scratch_depth--;
 }
 
-void* arena_push(arena_t* arena, size_t amount) {
+static size_t scratch_in_use() {
+  size_t total = 0;
+
+  for (int i = 0; i < ARRAY_LENGTH(scratch_arenas); ++i) {
+    total += scratch_arenas[i]->allocated;
+  }
+
+  return total;
+}
+
+static void tag_allocation(char* file, int line, size_t amount) {
+  size_t i = ((uintptr_t)file * 31 + line) & (MAX_ARENA_TAGS-1);
+
+  for (size_t probes = 0; probes < MAX_ARENA_TAGS; ++probes, i = (i + 1) & (MAX_ARENA_TAGS-1)) {
+    arena_tag_t* tag = arena_tags + i;
+
+    if (!tag->file) {
+      tag->file = file;
+      tag->line = line;
+    }
+
+    if (tag->file == file && tag->line == line) {
+      tag->count++;
+      tag->bytes += amount;
+      return;
+    }
+  }
+
+  assert(false && "out of allocation site tags");
+}
+
+void* _arena_push(arena_t* arena, size_t amount, char* file, int line) {
   if (amount == 0) {
     return NULL;
   }
@@ -113,15 +167,100 @@ void* arena_push(arena_t* arena, size_t amount) {
 
     arena->capacity += arena->page_size;
     arena->next_page = ptr_byte_add(arena->next_page, arena->page_size);
+    total_committed += arena->page_size;
   }
 
   arena->allocated = offset + amount;
+  arena->pushed += amount;
+  total_pushed += amount;
+
+  if (arena->allocated > arena->high_water) {
+    arena->high_water = arena->allocated;
+  }
+
+  if (arena->is_scratch) {
+    size_t in_use = scratch_in_use();
+
+    if (in_use > scratch_high_water) {
+      scratch_high_water = in_use;
+    }
+
+    if (in_use > scratch_window_peak) {
+      scratch_window_peak = in_use;
+    }
+  }
+
+  if (file) {
+    tag_allocation(file, line, amount);
+  }
 
   return ptr_byte_add(arena->base, offset);
 }
 
-void* arena_push_zeroed(arena_t* arena, size_t amount) {
-  void* ptr = arena_push(arena, amount);
+arena_stats_t arena_get_stats(arena_t* arena) {
+  return (arena_stats_t) {
+    .pushed = arena->pushed,
+    .allocated = arena->allocated,
+    .high_water = arena->high_water,
+    .committed = arena->capacity
+  };
+}
+
+arena_stats_t scratch_get_stats() {
+  arena_stats_t stats = {
+    .high_water = scratch_high_water
+  };
+
+  for (int i = 0; i < ARRAY_LENGTH(scratch_arenas); ++i) {
+    stats.pushed += scratch_arenas[i]->pushed;
+    stats.allocated += scratch_arenas[i]->allocated;
+    stats.committed += scratch_arenas[i]->capacity;
+  }
+
+  return stats;
+}
+
+int scratch_peak_depth() {
+  return scratch_max_depth;
+}
+
+size_t arena_total_pushed() {
+  return total_pushed;
+}
+
+size_t arena_total_committed() {
+  return total_committed;
+}
+
+size_t scratch_take_peak() {
+  size_t peak = scratch_window_peak;
+  scratch_window_peak = scratch_in_use();
+  return peak;
+}
+
+arena_tag_t* arena_get_tags(int* count) {
+  *count = MAX_ARENA_TAGS;
+  return arena_tags;
+}
+
+uint64_t time_now_ns() {
+  static LARGE_INTEGER frequency;
+
+  if (!frequency.QuadPart) {
+    QueryPerformanceFrequency(&frequency);
+  }
+
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+
+  uint64_t seconds = counter.QuadPart / frequency.QuadPart;
+  uint64_t remainder = counter.QuadPart % frequency.QuadPart;
+
+  return seconds * 1000000000 + remainder * 1000000000 / frequency.QuadPart;
+}
+
+void* _arena_push_zeroed(arena_t* arena, size_t amount, char* file, int line) {
+  void* ptr = _arena_push(arena, amount, file, line);
   memset(ptr, 0, amount);
   return ptr;
 }
\ No newline at end of file
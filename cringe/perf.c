@@ -0,0 +1,88 @@
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+  #define _DEFAULT_SOURCE // syscall isn't declared in strict c11
+#endif
+
+#include "perf.h"
+
+#define X(name, label, ...) label,
+static char* counter_label[] = {
+  #include "perf_counter.def"
+};
+#undef X
+
+char* perf_counter_label(perf_counter_t counter) {
+  return counter_label[counter];
+}
+
+#ifdef __linux__
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static int counter_fd[NUM_PERF_COUNTERS];
+static bool opened;
+
+static int open_counter(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+bool perf_open() {
+  if (opened) {
+    return true;
+  }
+
+  bool any = false;
+
+  #define X(name, label, type, config) counter_fd[PERF_##name] = open_counter(type, config); any |= counter_fd[PERF_##name] >= 0;
+  #include "perf_counter.def"
+  #undef X
+
+  if (!any) {
+    return false;
+  }
+
+  opened = true;
+  return true;
+}
+
+bool perf_available(perf_counter_t counter) {
+  return opened && counter_fd[counter] >= 0;
+}
+
+void perf_read(uint64_t values[NUM_PERF_COUNTERS]) {
+  for (int i = 0; i < NUM_PERF_COUNTERS; ++i) {
+    values[i] = 0;
+
+    if (perf_available(i) && read(counter_fd[i], &values[i], sizeof(values[i])) != sizeof(values[i])) {
+      values[i] = 0;
+    }
+  }
+}
+
+#else
+
+bool perf_open() {
+  return false;
+}
+
+bool perf_available(perf_counter_t counter) {
+  (void)counter;
+  return false;
+}
+
+void perf_read(uint64_t values[NUM_PERF_COUNTERS]) {
+  memset(values, 0, NUM_PERF_COUNTERS * sizeof(values[0]));
+}
+
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "base.h"
+
+// Hardware performance counters for the calling thread.
+// Only implemented with perf_event_open on linux, and even there any of them may be missing (VMs, containers, perf_event_paranoid).
+
+#define X(name, ...) PERF_##name,
+typedef enum {
+  #include "perf_counter.def"
+  NUM_PERF_COUNTERS
+} perf_counter_t;
+#undef X
+
+bool perf_open(); // false if no counter could be opened
+bool perf_available(perf_counter_t counter);
+char* perf_counter_label(perf_counter_t counter);
+
+void perf_read(uint64_t values[NUM_PERF_COUNTERS]); // unavailable counters read as zero
@@ -0,0 +1,553 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "json.h"
+#include "perf.h"
+#include "back/cb.h"
+
+#define MAX_PHASE_DEPTH 16
+#define UNIT_RECORD 0
+
+typedef struct {
+  char* name;
+  uint64_t phase_ns[NUM_STAT_PHASES];
+  uint64_t phase_bytes[NUM_STAT_PHASES];
+  uint64_t phase_committed[NUM_STAT_PHASES];
+  uint64_t phase_scratch_peak[NUM_STAT_PHASES];
+  uint64_t phase_perf[NUM_STAT_PHASES][NUM_PERF_COUNTERS];
+  uint64_t counters[NUM_STAT_COUNTERS];
+  uint64_t idealized[NUM_CB_NODE_KINDS];
+} stats_record_t;
+
+typedef struct {
+  char* name;
+  arena_t* arena;
+} tracked_arena_t;
+
+typedef struct {
+  uint64_t ns;
+  size_t bytes;
+  size_t committed;
+  size_t scratch_peak;
+  uint64_t perf[NUM_PERF_COUNTERS];
+} sample_t;
+
+typedef struct {
+  stat_phase_t phase;
+  int record;
+  sample_t start;
+} phase_frame_t;
+
+static struct {
+  bool enabled;
+  bool perf;
+  int current;
+  vec_t(stats_record_t) records;
+  vec_t(tracked_arena_t) arenas;
+
+  int depth;
+  phase_frame_t stack[MAX_PHASE_DEPTH];
+} stats;
+
+#define X(name, label, ...) label,
+static char* phase_label[] = {
+  #include "stat_phase.def"
+};
+
+static char* counter_label[] = {
+  #include "stat_counter.def"
+};
+#undef X
+
+static int new_record(char* name) {
+  stats_record_t record = {
+    .name = name
+  };
+
+  vec_put(stats.records, record);
+
+  return (int)vec_len(stats.records)-1;
+}
+
+void stats_enable() {
+  if (stats.enabled) {
+    return;
+  }
+
+  stats.enabled = true;
+  stats.current = new_record("<unit>");
+}
+
+bool stats_enabled() {
+  return stats.enabled;
+}
+
+bool stats_enable_perf() {
+  assert(stats.enabled);
+  stats.perf = perf_open();
+  return stats.perf;
+}
+
+void stats_track_arena(char* name, arena_t* arena) {
+  if (!stats.enabled) {
+    return;
+  }
+
+  tracked_arena_t tracked = {
+    .name = name,
+    .arena = arena
+  };
+
+  vec_put(stats.arenas, tracked);
+}
+
+void stats_set_func(char* name) {
+  if (!stats.enabled) {
+    return;
+  }
+
+  if (!name) {
+    stats.current = UNIT_RECORD;
+    return;
+  }
+
+  for (int i = UNIT_RECORD+1; i < (int)vec_len(stats.records); ++i) {
+    if (strcmp(stats.records[i].name, name) == 0) {
+      stats.current = i;
+      return;
+    }
+  }
+
+  stats.current = new_record(name);
+}
+
+static sample_t sample() {
+  sample_t s = {
+    .ns = time_now_ns(),
+    .bytes = arena_total_pushed(),
+    .committed = arena_total_committed(),
+    .scratch_peak = scratch_take_peak()
+  };
+
+  if (stats.perf) {
+    perf_read(s.perf);
+  }
+
+  return s;
+}
+
+static void charge(phase_frame_t* frame, sample_t* now) {
+  stats_record_t* record = stats.records + frame->record;
+  record->phase_ns[frame->phase] += now->ns - frame->start.ns;
+  record->phase_bytes[frame->phase] += now->bytes - frame->start.bytes;
+  record->phase_committed[frame->phase] += now->committed - frame->start.committed;
+
+  if (now->scratch_peak > record->phase_scratch_peak[frame->phase]) {
+    record->phase_scratch_peak[frame->phase] = now->scratch_peak;
+  }
+
+  for (int i = 0; i < NUM_PERF_COUNTERS; ++i) {
+    record->phase_perf[frame->phase][i] += now->perf[i] - frame->start.perf[i];
+  }
+}
+
+void stats_begin_phase(stat_phase_t phase) {
+  if (!stats.enabled) {
+    return;
+  }
+
+  assert(stats.depth < MAX_PHASE_DEPTH);
+
+  sample_t now = sample();
+
+  if (stats.depth) {
+    charge(&stats.stack[stats.depth-1], &now);
+  }
+
+  stats.stack[stats.depth++] = (phase_frame_t) {
+    .phase = phase,
+    .record = stats.current,
+    .start = now
+  };
+}
+
+void stats_end_phase(stat_phase_t phase) {
+  if (!stats.enabled) {
+    return;
+  }
+
+  assert(stats.depth > 0 && stats.stack[stats.depth-1].phase == phase);
+  (void)phase;
+
+  sample_t now = sample();
+
+  charge(&stats.stack[--stats.depth], &now);
+
+  // resume whatever phase we were nested inside
+  if (stats.depth) {
+    stats.stack[stats.depth-1].start = now;
+  }
+}
+
+void stats_count(stat_counter_t counter, uint64_t amount) {
+  if (!stats.enabled) {
+    return;
+  }
+
+  stats.records[stats.current].counters[counter] += amount;
+}
+
+void stats_count_idealized(int node_kind) {
+  if (!stats.enabled) {
+    return;
+  }
+
+  assert(node_kind >= 0 && node_kind < NUM_CB_NODE_KINDS);
+  stats.records[stats.current].idealized[node_kind]++;
+  stats.records[stats.current].counters[STAT_IDEALIZATIONS]++;
+}
+
+static stats_record_t sum_records() {
+  stats_record_t total = {
+    .name = "total"
+  };
+
+  for (size_t i = 0; i < vec_len(stats.records); ++i) {
+    stats_record_t* r = stats.records + i;
+
+    for (int j = 0; j < NUM_STAT_PHASES; ++j) {
+      total.phase_ns[j] += r->phase_ns[j];
+      total.phase_bytes[j] += r->phase_bytes[j];
+      total.phase_committed[j] += r->phase_committed[j];
+
+      if (r->phase_scratch_peak[j] > total.phase_scratch_peak[j]) {
+        total.phase_scratch_peak[j] = r->phase_scratch_peak[j];
+      }
+
+      for (int k = 0; k < NUM_PERF_COUNTERS; ++k) {
+        total.phase_perf[j][k] += r->phase_perf[j][k];
+      }
+    }
+
+    for (int j = 0; j < NUM_STAT_COUNTERS; ++j) {
+      total.counters[j] += r->counters[j];
+    }
+
+    for (int j = 0; j < NUM_CB_NODE_KINDS; ++j) {
+      total.idealized[j] += r->idealized[j];
+    }
+  }
+
+  return total;
+}
+
+static int column_width(char* label) {
+  int len = (int)strlen(label);
+  return (len > 10 ? len : 10) + 2;
+}
+
+static void print_table_header(FILE* stream, char* title, int count, char** labels) {
+  fprintf(stream, "%-16s", title);
+
+  for (int i = 0; i < count; ++i) {
+    fprintf(stream, "%*s", column_width(labels[i]), labels[i]);
+  }
+}
+
+static void print_table_row(FILE* stream, stats_record_t* r) {
+  uint64_t total_ns = 0;
+
+  for (int i = 0; i < NUM_STAT_PHASES; ++i) {
+    total_ns += r->phase_ns[i];
+  }
+
+  fprintf(stream, "%-16s", r->name);
+
+  for (int i = 0; i < NUM_STAT_PHASES; ++i) {
+    fprintf(stream, "%*.3f", column_width(phase_label[i]), (double)r->phase_ns[i] / 1e6);
+  }
+
+  fprintf(stream, "%*.3f", column_width("total"), (double)total_ns / 1e6);
+
+  uint64_t total_bytes = 0;
+
+  for (int i = 0; i < NUM_STAT_PHASES; ++i) {
+    total_bytes += r->phase_bytes[i];
+  }
+
+  fprintf(stream, "%*.1f", column_width("arena_kb"), (double)total_bytes / 1024.0);
+
+  for (int i = 0; i < NUM_STAT_COUNTERS; ++i) {
+    fprintf(stream, "%*llu", column_width(counter_label[i]), (unsigned long long)r->counters[i]);
+  }
+
+  fprintf(stream, "\n");
+}
+
+static double ratio(uint64_t a, uint64_t b) {
+  return b ? (double)a / (double)b : 0.0;
+}
+
+static void report_perf_table(FILE* stream, stats_record_t* total) {
+  uint64_t nodes = total->counters[STAT_NODES_CREATED];
+
+  fprintf(stream, "\nhardware counters by phase\n%-16s", "phase");
+
+  for (int i = 0; i < NUM_PERF_COUNTERS; ++i) {
+    fprintf(stream, "%*s", column_width(perf_counter_label(i)), perf_counter_label(i));
+  }
+
+  fprintf(stream, "%*s%*s%*s\n", column_width("ipc"), "ipc", column_width("l1d/node"), "l1d/node", column_width("llc/node"), "llc/node");
+
+  for (int i = 0; i < NUM_STAT_PHASES; ++i) {
+    uint64_t* perf = total->phase_perf[i];
+
+    fprintf(stream, "%-16s", phase_label[i]);
+
+    for (int j = 0; j < NUM_PERF_COUNTERS; ++j) {
+      if (perf_available(j)) {
+        fprintf(stream, "%*llu", column_width(perf_counter_label(j)), (unsigned long long)perf[j]);
+      }
+      else {
+        fprintf(stream, "%*s", column_width(perf_counter_label(j)), "n/a");
+      }
+    }
+
+    fprintf(stream, "%*.2f%*.2f%*.2f\n",
+      column_width("ipc"), ratio(perf[PERF_INSTRUCTIONS], perf[PERF_CYCLES]),
+      column_width("l1d/node"), ratio(perf[PERF_L1D_MISSES], nodes),
+      column_width("llc/node"), ratio(perf[PERF_LLC_MISSES], nodes));
+  }
+}
+
+static double kb(uint64_t bytes) {
+  return (double)bytes / 1024.0;
+}
+
+static int compare_tags(const void* a, const void* b) {
+  size_t x = ((arena_tag_t*)a)->bytes;
+  size_t y = ((arena_tag_t*)b)->bytes;
+  return (x < y) - (x > y);
+}
+
+// allocation sites sorted by bytes, only populated when built with CRINGE_ARENA_TAGS
+static arena_tag_t* sorted_tags(int* out_count) {
+  int capacity;
+  arena_tag_t* tags = arena_get_tags(&capacity);
+
+  arena_tag_t* sorted = calloc(capacity, sizeof(arena_tag_t));
+  assert(sorted);
+
+  int count = 0;
+
+  for (int i = 0; i < capacity; ++i) {
+    if (tags[i].file) {
+      sorted[count++] = tags[i];
+    }
+  }
+
+  qsort(sorted, count, sizeof(arena_tag_t), compare_tags);
+
+  *out_count = count;
+  return sorted;
+}
+
+static void print_arena_row(FILE* stream, char* name, arena_stats_t* s) {
+  fprintf(stream, "  %-14s%12.1f%12.1f%12.1f%12.1f\n", name, kb(s->pushed), kb(s->allocated), kb(s->high_water), kb(s->committed));
+}
+
+static void report_memory_table(FILE* stream, stats_record_t* total) {
+  fprintf(stream, "\nmemory by phase in kb\n%-16s%12s%12s%14s\n", "phase", "pushed", "committed", "scratch_peak");
+
+  for (int i = 0; i < NUM_STAT_PHASES; ++i) {
+    fprintf(stream, "%-16s%12.1f%12.1f%14.1f\n", phase_label[i], kb(total->phase_bytes[i]), kb(total->phase_committed[i]), kb(total->phase_scratch_peak[i]));
+  }
+
+  fprintf(stream, "\narenas in kb\n  %-14s%12s%12s%12s%12s\n", "arena", "pushed", "allocated", "high_water", "committed");
+
+  for (size_t i = 0; i < vec_len(stats.arenas); ++i) {
+    arena_stats_t s = arena_get_stats(stats.arenas[i].arena);
+    print_arena_row(stream, stats.arenas[i].name, &s);
+  }
+
+  arena_stats_t scratch = scratch_get_stats();
+  print_arena_row(stream, "scratch", &scratch);
+
+  fprintf(stream, "  scratch peak depth %d\n", scratch_peak_depth());
+
+  int tag_count;
+  arena_tag_t* tags = sorted_tags(&tag_count);
+
+  if (tag_count) {
+    fprintf(stream, "\nallocation sites by bytes\n");
+
+    for (int i = 0; i < tag_count && i < 20; ++i) {
+      char site[256];
+      snprintf(site, sizeof(site), "%s:%d", tags[i].file, tags[i].line);
+      fprintf(stream, "  %-32s%10zu allocs%12.1f kb\n", site, tags[i].count, kb(tags[i].bytes));
+    }
+  }
+
+  free(tags);
+}
+
+static void report_table(FILE* stream) {
+  stats_record_t total = sum_records();
+
+  fprintf(stream, "phase times in ms\n");
+  print_table_header(stream, "function", NUM_STAT_PHASES, phase_label);
+  fprintf(stream, "%*s%*s", column_width("total"), "total", column_width("arena_kb"), "arena_kb");
+  print_table_header(stream, "", NUM_STAT_COUNTERS, counter_label);
+  fprintf(stream, "\n");
+
+  for (size_t i = 0; i < vec_len(stats.records); ++i) {
+    print_table_row(stream, stats.records + i);
+  }
+
+  print_table_row(stream, &total);
+
+  report_memory_table(stream, &total);
+
+  if (stats.perf) {
+    report_perf_table(stream, &total);
+  }
+
+  fprintf(stream, "\nidealizations by kind\n");
+
+  for (int i = 0; i < NUM_CB_NODE_KINDS; ++i) {
+    if (total.idealized[i]) {
+      fprintf(stream, "  %-16s%llu\n", cb_node_kind_label(i), (unsigned long long)total.idealized[i]);
+    }
+  }
+}
+
+static void report_json_record(FILE* stream, stats_record_t* r) {
+  fprintf(stream, "{\"name\": \"%s\", \"phases\": {", r->name);
+
+  for (int i = 0; i < NUM_STAT_PHASES; ++i) {
+    fprintf(stream, "%s\"%s\": {\"ns\": %llu, \"arena_bytes\": %llu, \"committed_bytes\": %llu, \"scratch_peak_bytes\": %llu", i ? ", " : "", phase_label[i],
+      (unsigned long long)r->phase_ns[i], (unsigned long long)r->phase_bytes[i], (unsigned long long)r->phase_committed[i], (unsigned long long)r->phase_scratch_peak[i]);
+
+    if (stats.perf) {
+      uint64_t* perf = r->phase_perf[i];
+
+      for (int j = 0; j < NUM_PERF_COUNTERS; ++j) {
+        if (perf_available(j)) {
+          fprintf(stream, ", \"%s\": %llu", perf_counter_label(j), (unsigned long long)perf[j]);
+        }
+        else {
+          fprintf(stream, ", \"%s\": null", perf_counter_label(j));
+        }
+      }
+
+      fprintf(stream, ", \"ipc\": %.3f", ratio(perf[PERF_INSTRUCTIONS], perf[PERF_CYCLES]));
+    }
+
+    fprintf(stream, "}");
+  }
+
+  fprintf(stream, "}, \"counters\": {");
+
+  for (int i = 0; i < NUM_STAT_COUNTERS; ++i) {
+    fprintf(stream, "%s\"%s\": %llu", i ? ", " : "", counter_label[i], (unsigned long long)r->counters[i]);
+  }
+
+  fprintf(stream, "}, \"idealized\": {");
+
+  bool first = true;
+
+  for (int i = 0; i < NUM_CB_NODE_KINDS; ++i) {
+    if (r->idealized[i]) {
+      fprintf(stream, "%s\"%s\": %llu", first ? "" : ", ", cb_node_kind_label(i), (unsigned long long)r->idealized[i]);
+      first = false;
+    }
+  }
+
+  fprintf(stream, "}}");
+}
+
+static void report_json(FILE* stream) {
+  stats_record_t total = sum_records();
+
+  fprintf(stream, "{\n  \"functions\": [\n");
+
+  for (size_t i = 0; i < vec_len(stats.records); ++i) {
+    fprintf(stream, "    ");
+    report_json_record(stream, stats.records + i);
+    fprintf(stream, "%s\n", i+1 < vec_len(stats.records) ? "," : "");
+  }
+
+  fprintf(stream, "  ],\n  \"total\": ");
+  report_json_record(stream, &total);
+
+  fprintf(stream, ",\n  \"arenas\": [\n");
+
+  for (size_t i = 0; i <= vec_len(stats.arenas); ++i) {
+    bool scratch = i == vec_len(stats.arenas);
+    arena_stats_t s = scratch ? scratch_get_stats() : arena_get_stats(stats.arenas[i].arena);
+
+    fprintf(stream, "    {\"name\": \"%s\", \"pushed\": %zu, \"allocated\": %zu, \"high_water\": %zu, \"committed\": %zu}%s\n",
+      scratch ? "scratch" : stats.arenas[i].name, s.pushed, s.allocated, s.high_water, s.committed, scratch ? "" : ",");
+  }
+
+  fprintf(stream, "  ],\n  \"scratch_peak_depth\": %d,\n  \"allocation_sites\": [", scratch_peak_depth());
+
+  int tag_count;
+  arena_tag_t* tags = sorted_tags(&tag_count);
+
+  for (int i = 0; i < tag_count; ++i) {
+    fprintf(stream, "%s\n    {\"file\": ", i ? "," : "");
+    fprint_json_string(stream, tags[i].file); // __FILE__ is a full path with backslashes under msvc
+    fprintf(stream, ", \"line\": %d, \"count\": %zu, \"bytes\": %zu}", tags[i].line, tags[i].count, tags[i].bytes);
+  }
+
+  free(tags);
+
+  fprintf(stream, "%s]\n}\n", tag_count ? "\n  " : "");
+}
+
+void stats_report(FILE* stream, stats_format_t format) {
+  if (!stats.enabled) {
+    return;
+  }
+
+  assert(stats.depth == 0 && "phase still running");
+
+  switch (format) {
+    case STATS_FORMAT_TABLE:
+      report_table(stream);
+      break;
+
+    case STATS_FORMAT_JSON:
+      report_json(stream);
+      break;
+  }
+}
+
+uint64_t stats_phase_ns(stat_phase_t phase) {
+  if (!stats.enabled) {
+    return 0;
+  }
+
+  return sum_records().phase_ns[phase];
+}
+
+uint64_t stats_counter(stat_counter_t counter) {
+  if (!stats.enabled) {
+    return 0;
+  }
+
+  return sum_records().counters[counter];
+}
+
+void stats_reset() {
+  if (!stats.enabled) {
+    return;
+  }
+
+  assert(stats.depth == 0 && "phase still running");
+
+  vec_clear(stats.records);
+  stats.current = new_record("<unit>");
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "base.h"
+#include "instrument.h"
+
+// Compiler instrumentation, off unless stats_enable is called.
+// Phase times are exclusive - a nested phase pauses the one it was started inside of.
+
+typedef enum {
+  STATS_FORMAT_TABLE,
+  STATS_FORMAT_JSON,
+} stats_format_t;
+
+void stats_enable();
+bool stats_enabled();
+bool stats_enable_perf(); // also sample hardware counters at phase boundaries, false if there are none
+
+void stats_track_arena(char* name, arena_t* arena); // include this arena in the memory report
+
+void stats_set_func(char* name); // following stats are recorded against this function, NULL for the unit as a whole
+
+void stats_report(FILE* stream, stats_format_t format);
+
+// totals over every function so far
+uint64_t stats_phase_ns(stat_phase_t phase);
+uint64_t stats_counter(stat_counter_t counter);
+
+void stats_reset(); // drop everything recorded so far, phases can't be running
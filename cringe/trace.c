@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+#include "trace.h"
+#include "json.h"
+
+#define RING_CAPACITY (1 << 16) // power of two
+#define MAX_TRACE_DEPTH 64
+
+typedef struct {
+  char* name;
+  char* detail;
+  uint64_t start_ns;
+  uint64_t end_ns;
+} trace_event_t;
+
+typedef struct trace_buffer_t trace_buffer_t;
+
+struct trace_buffer_t {
+  trace_buffer_t* next;
+  int tid;
+
+  _Atomic(uint64_t) head; // events ever written, index into ring with RING_CAPACITY-1. released after each write for the flush
+  trace_event_t ring[RING_CAPACITY];
+
+  int depth;
+  trace_event_t open[MAX_TRACE_DEPTH];
+};
+
+bool trace_on;
+
+static char* trace_path;
+static uint64_t trace_epoch;
+
+static _Atomic(trace_buffer_t*) buffers;
+static atomic_int next_tid;
+
+static thread_local trace_buffer_t* thread_buffer;
+
+static trace_buffer_t* get_buffer() {
+  if (thread_buffer) {
+    return thread_buffer;
+  }
+
+  trace_buffer_t* buffer = calloc(1, sizeof(trace_buffer_t));
+  assert(buffer);
+
+  buffer->tid = atomic_fetch_add(&next_tid, 1) + 1;
+
+  // only ever pushed to, so a cas loop is enough to share it with the flush
+  trace_buffer_t* head = atomic_load(&buffers);
+
+  do {
+    buffer->next = head;
+  } while (!atomic_compare_exchange_weak(&buffers, &head, buffer));
+
+  return thread_buffer = buffer;
+}
+
+void _trace_begin(char* name, char* detail) {
+  trace_buffer_t* buffer = get_buffer();
+
+  if (buffer->depth < MAX_TRACE_DEPTH) {
+    buffer->open[buffer->depth] = (trace_event_t) {
+      .name = name,
+      .detail = detail,
+      .start_ns = time_now_ns()
+    };
+  }
+
+  buffer->depth++;
+}
+
+void _trace_end() {
+  trace_buffer_t* buffer = get_buffer();
+
+  assert(buffer->depth > 0 && "trace_end without trace_begin");
+  buffer->depth--;
+
+  if (buffer->depth >= MAX_TRACE_DEPTH) {
+    return;
+  }
+
+  trace_event_t event = buffer->open[buffer->depth];
+  event.end_ns = time_now_ns();
+
+  uint64_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed); // only this thread writes it
+  buffer->ring[head & (RING_CAPACITY-1)] = event;
+  atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
+
+static double to_us(uint64_t ns) {
+  return (double)ns / 1000.0;
+}
+
+static void trace_flush() {
+  FILE* file;
+  if (fopen_s(&file, trace_path, "w")) {
+    printf("Failed to write trace '%s'\n", trace_path);
+    return;
+  }
+
+  fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+
+  bool first = true;
+
+  for (trace_buffer_t* buffer = atomic_load(&buffers); buffer; buffer = buffer->next) {
+    fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}", first ? "" : ",\n", buffer->tid, buffer->tid);
+    first = false;
+
+    // the acquire pairs with _trace_end's release, so every event below head is fully written. the flush runs
+    // from atexit once the compile's threads are done - one still tracing could overwrite the oldest events
+    // of a full ring while they're read
+
+    uint64_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+    uint64_t start = head > RING_CAPACITY ? head - RING_CAPACITY : 0;
+
+    for (uint64_t i = start; i < head; ++i) {
+      trace_event_t* event = buffer->ring + (i & (RING_CAPACITY-1));
+
+      fprintf(file, ",\n{\"name\": ");
+      fprint_json_string(file, event->name);
+      fprintf(file, ", \"cat\": \"cringe\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+        buffer->tid, to_us(event->start_ns - trace_epoch), to_us(event->end_ns - event->start_ns));
+
+      if (event->detail) {
+        fprintf(file, ", \"args\": {\"detail\": ");
+        fprint_json_string(file, event->detail);
+        fprintf(file, "}");
+      }
+
+      fprintf(file, "}");
+    }
+  }
+
+  fprintf(file, "\n]}\n");
+  fclose(file);
+}
+
+void trace_enable(char* path) {
+  if (trace_on) {
+    return;
+  }
+
+  trace_path = path;
+  trace_epoch = time_now_ns();
+  trace_on = true;
+
+  atexit(trace_flush);
+}
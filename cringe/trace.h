@@ -0,0 +1,10 @@
+#pragma once
+
+#include "base.h"
+#include "instrument.h"
+
+// Chrome trace-event timeline (chrome://tracing or ui.perfetto.dev), off unless trace_enable is called.
+// Every thread records into its own ring buffer, so the oldest events are dropped if a thread overflows it.
+// The buffers are written out when the process exits.
+
+void trace_enable(char* path);
@@ -75,6 +75,7 @@ struct inst_t {
   token_t params[8];
 
   token_t print_string;
+  token_t encoding;
 };
 
 typedef struct node_inst_t node_inst_t;
@@ -437,6 +438,9 @@ static inst_t* parse_instruction(lexer_t* l) {
 
   inst->print_string = expect(l, TOK_STRING, "expected a print string");
 
+  expect(l, ';', "separate the print string and encoding with ';'");
+  inst->encoding = expect(l, TOK_STRING, "expected an encoding string");
+
   return inst;
 }
 
@@ -831,6 +835,120 @@ static void record_reg_read_or_write(int* inputs, int inputs_capacity, token_t t
   inputs[value] = code;
 }
 
+static bool is_hex_byte(const char* start, int length) {
+  return length == 2 && isxdigit(start[0]) && isxdigit(start[1]);
+}
+
+// encoding strings are space separated parts, '{...}' holds a c expression:
+//   XX          an opcode byte in hex
+//   W           sets REX.W
+//   /0 to /7    the ModRM reg field is an opcode extension
+//   /r          the ModRM reg field is the register given by reg:
+//   reg:{r}     register in the ModRM reg field
+//   rm:{r}      register in the ModRM rm field
+//   mem:{a}     alloca_t* in the ModRM rm field, addressed as [rbp-offset]
+//   +r:{r}      register added to the last opcode byte
+//   ib:{x} id:{x} 8 or 32 bit immediate
+//   is:{x}      32 bit immediate, shrunk to 8 bits with the sign-extend bit of the opcode when it fits
+//   rel:{b}     rel32 displacement to machine_block_t* b
+//   short:{x}   single byte opcode of the rel8 form of the branch
+static void write_inst_encoding(FILE* file, inst_t* inst) {
+  token_t enc = inst->encoding;
+  const char* p = enc.start + 1;
+  const char* end = enc.start + enc.length - 1;
+
+  while (p < end) {
+    while (p < end && *p == ' ') {
+      p++;
+    }
+
+    if (p == end) {
+      break;
+    }
+
+    const char* part = p;
+
+    while (p < end && *p != ' ' && *p != '{') {
+      p++;
+    }
+
+    int part_length = (int)(p - part);
+
+    const char* expr = NULL;
+    int expr_length = 0;
+
+    if (p < end && *p == '{') {
+      expr = ++p;
+      int depth = 1;
+
+      while (p < end && depth) {
+        depth += (*p == '{') - (*p == '}');
+        p++;
+      }
+
+      if (depth) {
+        printf("line %d: encoding {} does not close\n", enc.line);
+        exit(1);
+      }
+
+      expr_length = (int)(p - expr) - 1;
+    }
+
+    #define PART_IS(str) (part_length == (int)strlen(str) && memcmp(part, str, part_length) == 0)
+    #define NEEDS_EXPR() if (!expr) { printf("line %d: encoding part '%.*s' needs a {} value\n", enc.line, part_length, part); exit(1); }
+
+    if (is_hex_byte(part, part_length) && !expr) {
+      fprintf(file, "  enc.opcode[enc.opcode_count++] = 0x%.2s;\n", part);
+    }
+    else if (PART_IS("W")) {
+      fprintf(file, "  enc.rex_w = true;\n");
+    }
+    else if (part_length == 2 && part[0] == '/' && part[1] >= '0' && part[1] <= '7') {
+      fprintf(file, "  enc.reg_digit = %c;\n", part[1]);
+    }
+    else if (PART_IS("/r")) {
+    }
+    else if (PART_IS("reg:")) {
+      NEEDS_EXPR();
+      fprintf(file, "  enc.reg = %.*s;\n", expr_length, expr);
+    }
+    else if (PART_IS("rm:")) {
+      NEEDS_EXPR();
+      fprintf(file, "  enc.modrm = X64_MODRM_REG;\n");
+      fprintf(file, "  enc.rm = %.*s;\n", expr_length, expr);
+    }
+    else if (PART_IS("mem:")) {
+      NEEDS_EXPR();
+      fprintf(file, "  enc.modrm = X64_MODRM_MEM;\n");
+      fprintf(file, "  enc.mem = %.*s;\n", expr_length, expr);
+    }
+    else if (PART_IS("+r:")) {
+      NEEDS_EXPR();
+      fprintf(file, "  enc.opcode_reg = %.*s;\n", expr_length, expr);
+    }
+    else if (PART_IS("ib:") || PART_IS("id:") || PART_IS("is:")) {
+      NEEDS_EXPR();
+      fprintf(file, "  enc.imm_kind = %s;\n", part[1] == 'b' ? "X64_IMM8" : part[1] == 'd' ? "X64_IMM32" : "X64_IMM_SHRINK");
+      fprintf(file, "  enc.imm = (int32_t)(%.*s);\n", expr_length, expr);
+    }
+    else if (PART_IS("rel:")) {
+      NEEDS_EXPR();
+      fprintf(file, "  enc.target = %.*s;\n", expr_length, expr);
+    }
+    else if (PART_IS("short:")) {
+      NEEDS_EXPR();
+      fprintf(file, "  enc.short_opcode = %.*s;\n", expr_length, expr);
+    }
+    else {
+      printf("line %d: unknown encoding part '%.*s'\n", enc.line, part_length, part);
+      exit(1);
+    }
+
+    #undef PART_IS
+    #undef NEEDS_EXPR
+  }
+}
+
 int main(int argc, char** argv) {
   if (argc != 4) {
     printf("Usage: %s <isa_in> <isa_out> <node_kind_out>\n", argv[0]);
@@ -1020,6 +1138,30 @@ int main(int argc, char** argv) {
     fprintf(file, "}\n\n");
   }
 
+  foreach_list (inst_t, inst, isa.inst_head) {
+    fprintf(file, "static void encode_inst_%.*s(x64_encoder_t* e, machine_inst_t* inst) {\n", inst->name.length, inst->name.start);
+    fprintf(file, "  (void)inst;\n");
+    fprintf(file, "  x64_encoding_t enc = x64_encoding();\n");
+    write_inst_encoding(file, inst);
+    fprintf(file, "  x64_encode(e, &enc);\n");
+    fprintf(file, "}\n\n");
+  }
+
+  fprintf(file, "void encode_inst(x64_encoder_t* e, machine_inst_t* inst) {\n");
+
+  fprintf(file, "  switch (inst->op) {\n");
+  fprintf(file, "    default: assert(false); break;\n");
+
+  foreach_list (inst_t, inst, isa.inst_head) {
+    fprintf(file, "    case X64_INST_");
+    print_token_uppercase(file, inst->name);
+    fprintf(file, ": encode_inst_%.*s(e, inst); break;\n", inst->name.length, inst->name.start);
+  }
+
+  fprintf(file, "  }\n");
+
+  fprintf(file, "}\n\n");
+
   fprintf(file, "void print_inst(FILE* file, machine_inst_t* inst) {\n");
 
   fprintf(file, "  switch (inst->op) {\n");
@@ -0,0 +1,9 @@
+// expect: 35
+// both operands of a binary expression whose types already match have to reach the instruction
+int main() {
+  int a;
+  int b;
+  a = 6;
+  b = 7;
+  return a * b - a - b / 7;
+}
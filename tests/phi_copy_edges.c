@@ -0,0 +1,30 @@
+// expect: 3791
+// the copies for a phi have to go at the end of the predecessor on each incoming edge. the values the outer
+// loop's phis copy are defined in other blocks, and a copy placed there clobbers the phi on the other path
+int main() {
+  int a;
+  int b;
+  int c;
+  int d;
+  int e;
+  int i;
+  int j;
+  a = 66;
+  b = 91;
+  c = 36;
+  d = 62;
+  e = 49;
+  i = 6;
+  while (i) {
+    j = 5;
+    while (j) {
+      b = e + e - 1;
+      j = j - 1;
+    }
+    a = b / 4 + c;
+    b = c + c - 2;
+    i = i - 1;
+  }
+  e = d * a + 1;
+  return e + b;
+}
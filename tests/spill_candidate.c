@@ -0,0 +1,41 @@
+// expect: 3227
+// the divisions pin eax and edx inside the loop, and every register left to simplify ends up with an infinite
+// spill cost. the allocator still has to pick one of them as the spill candidate
+int main() {
+  int a;
+  int b;
+  int c;
+  int d;
+  int e;
+  int f;
+  int i;
+  int j;
+  a = 44;
+  b = 20;
+  c = 16;
+  d = 58;
+  e = 82;
+  f = 12;
+  b = e * c - 5;
+  c = a - f + 8;
+  d = f * d + 3;
+  i = 8;
+  while (i) {
+    j = 2;
+    while (j) {
+      f = e / 6 + f;
+      e = c / 3 + c;
+      e = f / 6 + d;
+      e = c / 3 + b;
+      j = j - 1;
+    }
+    a = a / 1 + a;
+    e = c / 5 + d;
+    b = e / 5 + f;
+    a = e / 5 + b;
+    i = i - 1;
+  }
+  return e + b;
+}
+
+
@@ -0,0 +1,28 @@
+// expect: 75
+// the divisions spill a register that the same two-address instruction reads and writes, so its reload and its
+// store have to use one temporary
+int main() {
+  int a;
+  int b;
+  int c;
+  int d;
+  int e;
+  int i;
+  int j;
+  a = 66;
+  b = 20;
+  c = 91;
+  d = 62;
+  e = 49;
+  i = 6;
+  while (i) {
+    j = 5;
+    while (j) {
+      c = b / 3 + b;
+      a = d / 1 + c;
+      j = j - 1;
+    }
+    i = i - 1;
+  }
+  return e + c;
+}